@@ -65,6 +65,7 @@ namespace tams
     bool color_segments;
     int first_index;
     int last_index;
+    int queue_depth;
     ApplicationOptions ()
     {
       output_suffix = output_dir = "";
@@ -73,6 +74,7 @@ namespace tams
       input_prefix = "scan";
       segments_dir = "";
       first_index = last_index = 0;
+      queue_depth = 2;
       color_segments = false;
     }
   };
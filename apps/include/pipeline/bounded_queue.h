@@ -0,0 +1,138 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+#ifndef PIPELINE_BOUNDED_QUEUE_H_
+#define PIPELINE_BOUNDED_QUEUE_H_
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace tams
+{
+  /** \brief Blocking FIFO queue with a maximum depth between two stages of a pipeline.
+    * push () waits while the queue is full, pop () waits while it is empty. After close () the queue
+    * accepts nothing more and pop () returns false once it is drained. The depth seen by every push is
+    * recorded, for reporting how far the producer runs ahead of the consumer.
+    */
+  template <typename T>
+  class BoundedQueue
+  {
+    public:
+      explicit
+      BoundedQueue (size_t capacity):
+        capacity_ (capacity > 0 ? capacity : 1), closed_ (false), push_count_ (0), depth_sum_ (0), max_depth_ (0)
+      {
+      }
+
+      /** \brief Append an item, waiting for free space. Returns false if the queue has been closed. */
+      bool
+      push (const T &item)
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        while (!closed_ && items_.size () >= capacity_)
+          not_full_.wait (lock);
+        if (closed_)
+          return (false);
+        items_.push_back (item);
+        push_count_++;
+        depth_sum_ += items_.size ();
+        if (items_.size () > max_depth_)
+          max_depth_ = items_.size ();
+        not_empty_.notify_one ();
+        return (true);
+      }
+
+      /** \brief Take the oldest item, waiting for one. Returns false if the queue is closed and empty. */
+      bool
+      pop (T &item)
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        while (!closed_ && items_.empty ())
+          not_empty_.wait (lock);
+        if (items_.empty ())
+          return (false);
+        item = items_.front ();
+        items_.pop_front ();
+        not_full_.notify_one ();
+        return (true);
+      }
+
+      /** \brief No more items will be pushed, the waiting producers and consumers are woken up. */
+      void
+      close ()
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        closed_ = true;
+        not_full_.notify_all ();
+        not_empty_.notify_all ();
+      }
+
+      size_t
+      capacity () const {return capacity_;}
+
+      /** \brief Mean depth after a push, including the pushed item. */
+      double
+      meanDepth () const
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        return (push_count_ > 0 ? static_cast<double> (depth_sum_) / push_count_ : 0.0);
+      }
+
+      size_t
+      maxDepth () const
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        return (max_depth_);
+      }
+
+    private:
+      size_t capacity_;
+      bool closed_;
+      std::deque<T> items_;
+      mutable boost::mutex mutex_;
+      boost::condition_variable not_full_;
+      boost::condition_variable not_empty_;
+      size_t push_count_;
+      size_t depth_sum_;
+      size_t max_depth_;
+  };
+}
+
+#endif
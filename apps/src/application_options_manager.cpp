@@ -118,7 +118,8 @@ namespace tams
       ("input.segments-dir", po::value<std::string>(&(app_options_.segments_dir)),"directory where input files are")
       ("input.pcd-prefix", po::value<std::string>(&(app_options_.input_prefix)), "prefix for input files")
       ("input.first-index", po::value<int>(&(app_options_.first_index)), "first scan number")
-      ("input.last-index", po::value<int>(&(app_options_.last_index)), "last scan number");
+      ("input.last-index", po::value<int>(&(app_options_.last_index)), "last scan number")
+      ("input.queue-depth", po::value<int>(&(app_options_.queue_depth)), "number of scans buffered between two stages of the pipelined mapper");
 
     output_opts_desc_.add_options()
       ("output.directory", po::value<string>(&(app_options_.output_dir)), "directory where output files should be stored")
@@ -136,7 +137,13 @@ namespace tams
       ("registration.side-rotation-ability", po::value<double>(&(registration_params_.side_rotation_ability)), "the biggest rotation angle according to the robot's kinematic model")
       ("registration.max-translation-norm", po::value<double>(&(registration_params_.max_translation_norm)), "the biggest distance between two sensor poses")
       ("registration.max-angle-diff", po::value<double>(&(registration_params_.max_angle_diff)), "the threshold for rotation consistent")
-      ("registration.max-bias-diff", po::value<double>(&(registration_params_.max_bias_diff)), "the threshold for transformation consistent");
+      ("registration.max-bias-diff", po::value<double>(&(registration_params_.max_bias_diff)), "the threshold for transformation consistent")
+      ("registration.threads", po::value<int>(&(registration_params_.threads)), "number of threads for the hypothesis generation, 0 for all cores")
+      ("registration.time-budget", po::value<double>(&(registration_params_.time_budget)), "wall-clock budget of the hypothesis search and scoring in seconds, the best solution so far is refined and returned, 0 for no limit")
+      ("registration.min-confidence", po::value<double>(&(registration_params_.min_confidence)), "stop the hypothesis search once this fraction of the data segment area is explained, 0 to search all")
+      ("registration.refine-iterations", po::value<int>(&(registration_params_.refine_iterations)), "maximum number of point-to-plane refinement steps of the final solution, 0 for no refinement")
+      ("registration.refine-tolerance", po::value<double>(&(registration_params_.refine_tolerance)), "tolerated standard deviation of the plane offsets for subsampling the refinement, 0 to use all points")
+      ("registration.prior-gate", po::value<double>(&(registration_params_.prior_gate)), "hypotheses farther than this number of standard deviations from the pose prior are not generated");
     visible_opts_desc_.add(seg_opts_desc_);
     visible_opts_desc_.add(sensor_opts_desc_);
     visible_opts_desc_.add(octree_seg_opts_desc_);
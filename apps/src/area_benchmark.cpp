@@ -37,427 +37,331 @@
  *
  */
 
+/** \brief Benchmark of the area calculation methods on synthetic scans of planar patches with known area.
+  * Each patch is ray cast on the organized grid of the range sensor given in the [sensor] section of the
+  * config file, using the polynomial noise model along the beams. Run time and accuracy of every
+  * SegmentsArea::AreaCalculationMethod are written to a CSV file, one line per patch, method and thread count.
+  */
+
 //STL
 #include <vector>
+#include <string>
 #include <fstream>
-//PCL
-#include <pcl/filters/statistical_outlier_removal.h>
-#include <pcl/filters/voxel_grid.h>
-#include <pcl/visualization/pcl_visualizer.h>
-#include <pcl/visualization/point_cloud_handlers.h>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <sys/time.h>
 //boost
-#include <boost/timer.hpp>
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/variate_generator.hpp>
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
 //tams
-#include "region_growing_segmentation/region_growing_segmentation.h"
-#include "region_growing_segmentation/impl/region_growing_segmentation.hpp"
-#include "octree_region_growing_segmentation/octree_region_growing_segmentation.h"
-#include "application_options_manager/application_options_manager.h"
-#include "abstract_planar_segment/abstract_planar_segment.h"
+#include "common/sensor_parameters.h"
+#include "common/planar_patch.h"
 #include "segments_area/segments_area.h"
 
 using namespace tams;
-using namespace Eigen;
-
-int
-main (int argc, char **argv)
-{
-  ApplicationOptionsManager amgr;
-  if (!amgr.readOptions (argc, argv))
-    return -1;
-  OctreeRGSegmentation octree_segmenter;
-  PlanarSegment::StdVectorPtr segments(new PlanarSegment::StdVector);
-  AbstractPlanarSegment::StdVectorPtr abstract_segments(new AbstractPlanarSegment::StdVector);
-  AbstractPlanarSegment abstract_segment;
+namespace po = boost::program_options;
 
-  struct timeval tpstart,tpend;
-  double timeuse;
+enum PatchShape {Convex, LShaped, Holed};
 
-  enum DatasetType { BRL, ScrapYard, CrashedCarPark, BremenCity, DellBoxes};
-  DatasetType dataset = BremenCity;
+/** \brief A rectangular planar patch facing the sensor, rotated by tilt about the vertical axis. */
+struct PatchSpec
+{
+  PatchShape shape;
+  double width;
+  double height;
+  double range;
+  double tilt;
+};
 
-  pcl::visualization::PCLVisualizer *pViewer;
-  pViewer = new pcl::visualization::PCLVisualizer (argc, argv, "show area attributed planar segments");
-  pViewer->setBackgroundColor (1,1,1);
-  pViewer->spin ();
+static const char *shape_names[] = {"convex", "l-shaped", "holed"};
+static const char *method_names[] = {"SumOfSmallFaces", "DelaunayTriangulation", "AlphaShape",
+                                     "NumberOfSquareUnits", "OccupancyGrid"};
 
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr output (new pcl::PointCloud<pcl::PointXYZRGB>);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr ognzd_cloud (new pcl::PointCloud<pcl::PointXYZ>);
-  std::string prefix = amgr.app_options_.organized_pcd_dir + amgr.app_options_.input_prefix;
-  std::ofstream time_output;
-  time_output.open("k50.txt");
-  for (int scan_index = amgr.app_options_.first_index; scan_index <= amgr.app_options_.last_index; scan_index++)
+/** \brief Whether the in-plane coordinates (u, v) lie on the patch. */
+bool
+insidePatch (const PatchSpec &patch, double u, double v)
+{
+  if (fabs (u) > patch.width / 2 || fabs (v) > patch.height / 2)
+    return (false);
+  switch (patch.shape)
   {
-    char buf[4];
-    sprintf (buf, "%03d", scan_index);
-    std::string pcd_file = prefix + std::string (buf) + ".pcd";
-    std::string segments_file = amgr.app_options_.output_dir + "/segments" + std::string (buf);
-    std::string screenshot = "/home/tams/workspace/pcl/segments/segment" + std::string (buf);
-    std::string png_file;
-    if (pcl::io::loadPCDFile<pcl::PointXYZ> (pcd_file, *ognzd_cloud) == -1) //* load the file
-    {
-      PCL_ERROR ("Couldn't read file %s!\n", pcd_file.c_str());
-      return (-1);
-    }
-    PCL_INFO ("Loaded %d points with width: %d and height: %d from %s.\n",
-              ognzd_cloud->points.size(), ognzd_cloud->width, ognzd_cloud->height, pcd_file.c_str ());
-
-    if (dataset == BRL)
-    {
-      for (int i = 0; i < ognzd_cloud->size(); i++)
-      {
-        if (ognzd_cloud->points[i].x * ognzd_cloud->points[i].x +
-            ognzd_cloud->points[i].y * ognzd_cloud->points[i].y +
-            ognzd_cloud->points[i].z * ognzd_cloud->points[i].z > 30 * 30)
+    case LShaped:
+      return (!(u > 0 && v > 0));
+    case Holed:
+      return (!(fabs (u) < patch.width / 6 && fabs (v) < patch.height / 6));
+    default:
+      return (true);
+  }
+}
 
-        {
-          ognzd_cloud->points[i].x = ognzd_cloud->points[i].y = ognzd_cloud->points[i].z = NAN;
-        }
-        if (ognzd_cloud->points[i].z < 0 &&
-            (ognzd_cloud->points[i].x * ognzd_cloud->points[i].x +
-             ognzd_cloud->points[i].y * ognzd_cloud->points[i].y) < 0.7225)
-        {
-          ognzd_cloud->points[i].x = ognzd_cloud->points[i].y = ognzd_cloud->points[i].z = NAN;
-        }
-      }
-    }
+/** \brief The analytic area of the patch. */
+double
+patchArea (const PatchSpec &patch)
+{
+  double area = patch.width * patch.height;
+  switch (patch.shape)
+  {
+    case LShaped:
+      return (area * 0.75);
+    case Holed:
+      return (area * 8.0 / 9.0);
+    default:
+      return (area);
+  }
+}
 
-    octree_segmenter.setParameters (amgr.octree_seg_params_);
-//    octree_segmenter.setSensorNoiseModel(amgr.sensor_params_.polynomial_noise_a0,
-//                                         amgr.sensor_params_.polynomial_noise_a1,
-//                                         amgr.sensor_params_.polynomial_noise_a2);
-    octree_segmenter.setInput (ognzd_cloud);
+/** \brief Scan the patch with the organized sensor grid, the grid only covers the patch's angular extent.
+  * \param[in] patch the patch to be scanned
+  * \param[in] sensor resolution and polynomial noise model of the sensor
+  * \param[in] rng normal distributed random numbers
+  * \param[out] cloud the organized cloud, NaN where the beam misses the patch
+  * \param[out] segment the points and attributes of the scanned patch
+  */
+void
+scanPatch (const PatchSpec &patch, const SensorParameters &sensor,
+           boost::variate_generator<boost::mt19937&, boost::normal_distribution<> > &rng,
+           pcl::PointCloud<pcl::PointXYZ> &cloud, PlanarSegment &segment)
+{
+  const Eigen::Vector3d center (patch.range, 0.0, 0.0);
+  const Eigen::Vector3d normal (-cos (patch.tilt), sin (patch.tilt), 0.0);
+  const Eigen::Vector3d axis_u (sin (patch.tilt), cos (patch.tilt), 0.0);
+  const Eigen::Vector3d axis_v (0.0, 0.0, 1.0);
+  const double horizontal_step = sensor.horizontal_resolution * M_PI / 180;
+  const double vertical_step = sensor.vertical_resolution * M_PI / 180;
 
-    gettimeofday(&tpstart,NULL);
-    octree_segmenter.octreeCaching();
-    gettimeofday(&tpend,NULL);
-    timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-    timeuse/=1000000;
-    std::cout << "Octree caching time: " << timeuse << std::endl;
-    time_output << timeuse << " ";
-    gettimeofday(&tpstart,NULL);
-    octree_segmenter.segmentation ();
-    gettimeofday(&tpend,NULL);
-    timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-    timeuse/=1000000;
-    std::cout << "segmentation time: " << timeuse << std::endl;
-    time_output << timeuse << " ";
+  double min_azimuth = M_PI, max_azimuth = -M_PI, min_elevation = M_PI, max_elevation = -M_PI;
+  for (int i = 0; i < 4; i++)
+  {
+    Eigen::Vector3d corner = center + ((i & 1) ? 0.5 : -0.5) * patch.width * axis_u
+                                    + ((i & 2) ? 0.5 : -0.5) * patch.height * axis_v;
+    double azimuth = atan2 (corner(1), corner(0));
+    double elevation = atan2 (corner(2), sqrt (corner(0) * corner(0) + corner(1) * corner(1)));
+    min_azimuth = std::min (min_azimuth, azimuth);
+    max_azimuth = std::max (max_azimuth, azimuth);
+    min_elevation = std::min (min_elevation, elevation);
+    max_elevation = std::max (max_elevation, elevation);
+  }
+  /// two empty beams of margin, the organized methods do not evaluate the border pixels
+  const int cols = static_cast<int> ((max_azimuth - min_azimuth) / horizontal_step) + 5;
+  const int rows = static_cast<int> ((max_elevation - min_elevation) / vertical_step) + 5;
+  cloud.points.resize (cols * rows);
+  cloud.width = cols;
+  cloud.height = rows;
+  cloud.is_dense = false;
 
-    segments = octree_segmenter.getSegments();
-    abstract_segment.setSensorNoiseModel(amgr.sensor_params_.polynomial_noise_a0,
-                                         amgr.sensor_params_.polynomial_noise_a1,
-                                         amgr.sensor_params_.polynomial_noise_a2);
-    abstract_segments->clear();
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
+  segment = PlanarSegment ();
+  const double offset = normal.dot (center);
+  for (int i = 0; i < rows; i++)
+  {
+    const double elevation = max_elevation - (i - 2) * vertical_step;
+    for (int j = 0; j < cols; j++)
     {
-      abstract_segment.calculateAttributes(it, ognzd_cloud);
-      abstract_segments->push_back(abstract_segment);
+      const double azimuth = min_azimuth + (j - 2) * horizontal_step;
+      const Eigen::Vector3d beam (cos (elevation) * cos (azimuth), cos (elevation) * sin (azimuth), sin (elevation));
+      pcl::PointXYZ &point = cloud.points[i * cols + j];
+      point.x = point.y = point.z = NAN;
+      const double t = offset / normal.dot (beam);
+      if (!(t > 0))
+        continue;
+      const Eigen::Vector3d hit = t * beam - center;
+      if (!insidePatch (patch, hit.dot (axis_u), hit.dot (axis_v)))
+        continue;
+      const double sigma = sensor.polynomial_noise_a0 + sensor.polynomial_noise_a1 * t + sensor.polynomial_noise_a2 * t * t;
+      const Eigen::Vector3d p = (t + sigma * rng ()) * beam;
+      point.x = p(0);
+      point.y = p(1);
+      point.z = p(2);
+      segment.points.push_back (i * cols + j);
+      segment.sum += p;
+      segment.second_moment += p * p.transpose ();
     }
+  }
 
-    gettimeofday(&tpstart,NULL);
-    octree_segmenter.uncertainties();
-    gettimeofday(&tpend,NULL);
-    timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-    timeuse/=1000000;
-    std::cout << "plane parameter uncertainty computation time: " << timeuse << std::endl;
-    time_output << timeuse << std::endl;
+  segment.point_num = segment.points.size ();
+  if (segment.point_num == 0)
+    return;
+  segment.mass_center = segment.sum / segment.point_num;
+  segment.scatter_matrix = segment.second_moment - segment.point_num * segment.mass_center * segment.mass_center.transpose ();
+  segment.normal = normal;
+  segment.bias = normal.dot (segment.mass_center);
+  if (segment.bias < 0)
+  {
+    segment.normal = -segment.normal;
+    segment.bias = -segment.bias;
+  }
+}
 
+double
+elapsedMilliseconds (const struct timeval &start, const struct timeval &end)
+{
+  return (1000.0 * (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000.0);
+}
 
-//    gettimeofday(&tpstart,NULL);
-//    octree_segmenter.segmentsArea();
-//    gettimeofday(&tpend,NULL);
-//    timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-//    timeuse/=1000000;
-//    std::cout << "area computation time: " << timeuse << std::endl;
-//    time_output << timeuse << std::endl;
+int
+main (int argc, char **argv)
+{
+  SensorParameters sensor;
+  std::string config_file, output_file;
+  std::vector<double> sizes, ranges;
+  std::vector<int> thread_counts;
+  double tilt;
+  int repetitions;
+  unsigned int seed;
 
-    std::vector<double> area;
-    area.resize (4 * segments->size ());
-    int i = 0;
-    SegmentsArea areaByDelaunayTriangulation(ognzd_cloud, segments, SegmentsArea::DelaunayTriangulation);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaByAlphaShape(ognzd_cloud, segments, SegmentsArea::AlphaShape);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaByNumberOfSquareUnits(ognzd_cloud, segments, SegmentsArea::NumberOfSquareUnits, 0.5, 0.25);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaBySumOfSmallFaces(ognzd_cloud, segments, SegmentsArea::SumOfSmallFaces);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    std::string file_name;
-    file_name = "scan" + std::string(buf) + "_area.txt";
-    std::ofstream of;
-    of.open (file_name.c_str ());
-    for (size_t j = 0; j < segments->size (); j++)
+  po::options_description visible ("Area benchmark options");
+  visible.add_options ()
+    ("help,h", "produces help message")
+    ("config-file", po::value<std::string> (&config_file), "config file with the [sensor] section")
+    ("sensor.vertical-resolution", po::value<double> (&sensor.vertical_resolution)->default_value (0.25), "vertical resolution of the range sensor")
+    ("sensor.horizontal-resolution", po::value<double> (&sensor.horizontal_resolution)->default_value (0.25), "horizontal resolution of the range sensor")
+    ("sensor.poly-standard-deviation.a0", po::value<double> (&sensor.polynomial_noise_a0)->default_value (0.0), "the polynomial noisy model")
+    ("sensor.poly-standard-deviation.a1", po::value<double> (&sensor.polynomial_noise_a1)->default_value (0.0), "the polynomial noisy model")
+    ("sensor.poly-standard-deviation.a2", po::value<double> (&sensor.polynomial_noise_a2)->default_value (0.0), "the polynomial noisy model")
+    ("benchmark.size", po::value<std::vector<double> > (&sizes)->multitoken (), "patch widths in meter, the height is 3/4 of the width")
+    ("benchmark.range", po::value<std::vector<double> > (&ranges)->multitoken (), "distances of the patches from the sensor in meter")
+    ("benchmark.tilt", po::value<double> (&tilt)->default_value (30.0), "angle between patch normal and the sensor's x-axis in degrees")
+    ("benchmark.threads", po::value<std::vector<int> > (&thread_counts)->multitoken (), "thread counts for the multi-threaded methods")
+    ("benchmark.repetitions", po::value<int> (&repetitions)->default_value (5), "the fastest of these runs is reported")
+    ("benchmark.seed", po::value<unsigned int> (&seed)->default_value (42), "seed of the noise generator")
+    ("benchmark.output", po::value<std::string> (&output_file)->default_value ("area_benchmark.csv"), "the resulted CSV file");
+  po::positional_options_description positional;
+  positional.add ("config-file", 1);
+
+  po::variables_map vm;
+  po::store (po::command_line_parser (argc, argv).options (visible).positional (positional).run (), vm);
+  if (vm.count ("config-file"))
+  {
+    std::ifstream fin (vm["config-file"].as<std::string> ().c_str ());
+    if (!fin.is_open ())
     {
-      of << area[j] << " "
-         << area[j + segments->size ()] << " "
-         << area[j + 2 * segments->size ()] << " "
-         << area[j + 3 * segments->size ()] << std::endl;
-      std::cerr << area[j] << " "
-                << area[j + segments->size ()] << " "
-                << area[j + 2 * segments->size ()] << " "
-                << area[j + 3 * segments->size ()] << std::endl;
+      std::cerr << "Can't open specified config file \"" << vm["config-file"].as<std::string> () << "\"" << std::endl;
+      return (-1);
     }
-    of.close ();
-
-
-    if (amgr.app_options_.color_segments)
-      octree_segmenter.randomColours (output, 0.0, true);
-    //octree_segmenter.colourAccordingToUncertainty(output);
+    /// the other sections of the shared config files are ignored
+    po::store (po::parse_config_file (fin, visible, true), vm);
+  }
+  po::notify (vm);
+  if (vm.count ("help"))
+  {
+    std::cout << "Usage: area_benchmark [options] [config.ini]" << std::endl << visible << std::endl;
+    return (0);
+  }
+  if (sizes.empty ())
+  {
+    double default_sizes[] = {0.5, 1.0, 2.0, 4.0, 8.0};
+    sizes.assign (default_sizes, default_sizes + 5);
+  }
+  if (ranges.empty ())
+  {
+    double default_ranges[] = {5.0, 15.0};
+    ranges.assign (default_ranges, default_ranges + 2);
+  }
+  if (thread_counts.empty ())
+  {
+    int default_threads[] = {1, 2, 4};
+    thread_counts.assign (default_threads, default_threads + 3);
+  }
+  if (sensor.vertical_resolution <= 0.0 || sensor.horizontal_resolution <= 0.0 || repetitions < 1)
+  {
+    std::cerr << "The sensor resolution and the number of repetitions have to be positive.\n";
+    return (-1);
+  }
 
-    segments = octree_segmenter.segments();
+  std::ofstream csv (output_file.c_str ());
+  if (!csv.is_open ())
+  {
+    std::cerr << "Can't open " << output_file << " for writing.\n";
+    return (-1);
+  }
+  csv << "shape,width,height,range,tilt,points,method,threads,true_area,area,relative_error,time_ms\n";
 
-//    time_output << segments->size() << " " << timeuse << " ";
-//    of.open(segments_file.c_str());
-//    of << 0.0 << " " << 0.0 << " " << 0.0 << std::endl;
-//    of << segments->size() << std::endl;
-//    for (PlanarSegments::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-//    {
-//      // normal.x normal.y normal.z bias mse area point_num
-//      of << it->normal(0) << " " << it->normal(1) << " " << it->normal(2) << " " << it->bias << " "
-//         << it->mse << " " << it->area << " " << it->point_num << " "
-//         << it->mass_center(0) << " " << it->mass_center(1) << " " << it->mass_center(2) << std::endl;
-//    }
-//    of.close();
+  boost::mt19937 engine (seed);
+  boost::normal_distribution<> distribution (0.0, 1.0);
+  boost::variate_generator<boost::mt19937&, boost::normal_distribution<> > rng (engine, distribution);
 
-/*
-    if (amgr.app_options_.color_segments)
-    {
-      pViewer->addPointCloud (output, "segments");
-      pViewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "segments");
-      pViewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_OPACITY, 0.9, "segments");
-      for (PlanarSegments::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-      {
-        if (it->area < 0.5)
-          continue;
-        std::ostringstream area, area_full;
-        area << setiosflags(ios::fixed) << setprecision(2) << it->area;
-        //area << it->area;
-        area_full << it->area;
-        pcl::PointXYZ position;
-        position.x = it->mass_center (0);
-        position.y = it->mass_center (1);
-        position.z = it->mass_center (2);
-        pViewer->addText3D (area.str (), position, 0.4, 0.0, 0.0, 0.0, area_full.str (), 0);
-      }
-      //      pViewer->setCameraPose(50.0, 0.0, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_0.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(0.0, 50.0, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_1.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(-50.0, 0.0, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_2.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(0.0, -50.0, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_3.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(0.0, -50.0, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_3.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(35.4, 35.4, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_4.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(-35.4, 35.4, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_5.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(-35.4, -35.4, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_6.png";
-      //      pViewer->saveScreenshot(png_file);
-      //      pViewer->setCameraPose(35.4, -35.4, 50.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0);
-      //      pViewer->spinOnce(100);
-      //      png_file = screenshot + "_vp_7.png";
-      //      pViewer->saveScreenshot(png_file);
-      pViewer->spin();
-      pViewer->removePointCloud("segments");
-      for (PlanarSegments::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-      {
-        if (it->area < 0.5)
-          continue;
-        std::ostringstream area, area_full;
-        area << setiosflags(ios::fixed) << setprecision(2) << it->area;
-        area_full << it->area;
-        pViewer->removeText3D(area_full.str());
-      }
-      pViewer->spinOnce (100);
-      //      pcl::visualization::PCLVisualizer viewer ("Detected planes with Pseudo-color");
-      //      int viewports[2] = {1, 2};
-      //      viewer.createViewPort (0.0, 0.0, 0.5, 1.0, viewports[0]);
-      //      viewer.createViewPort (0.5, 0.0, 1.0, 1.0, viewports[1]);
-      //      viewer.addPointCloud (output, "segments", viewports[0]);
-      //      viewer.addPointCloud (output, "areaed_segments", viewports[1]);
-      //      viewer.setBackgroundColor (1.0, 1.0, 1.0);
-      //      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "areaed_segments");
-      //      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "segments");
-      //      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_OPACITY, 0.5, "areaed_segments");
-      //      viewer.setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_OPACITY, 0.4, "segments");
-      //      for (std::vector<tamrot::PlanarSegments>::iterator it = segments->begin(); it != segments->end(); it++)
-      //      {
-      //        if (it->area < 0.5)    std::vector<double> area;
-    area.resize (4 * segments->size ());
-    int i = 0;
-    SegmentsArea areaByDelaunayTriangulation(ognzd_cloud, segments, SegmentsArea::DelaunayTriangulation);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaByAlphaShape(ognzd_cloud, segments, SegmentsArea::AlphaShape);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaByNumberOfSquareUnits(ognzd_cloud, segments, SegmentsArea::NumberOfSquareUnits, 0.5, 0.25);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    SegmentsArea areaBySumOfSmallFaces(ognzd_cloud, segments, SegmentsArea::SumOfSmallFaces);
-    for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-    {
-      area[i] = it->area;
-      i++;
-    }
-    std::string file_name;
-    file_name = "scan" + std::string(buf) + "_area.txt";
-    std::ofstream of;
-    of.open (file_name.c_str ());
-    for (size_t j = 0; j < segments->size (); j++)
-    {
-      of << area[j] << " "
-         << area[j + segments->size ()] << " "
-         << area[j + 2 * segments->size ()] << " "
-         << area[j + 3 * segments->size ()] << std::endl;
-      std::cerr << area[j] << " "
-                << area[j + segments->size ()] << " "
-                << area[j + 2 * segments->size ()] << " "
-                << area[j + 3 * segments->size ()] << std::endl;
-    }
-    of.close ();
-      //          continue;
-      //        std::ostringstream area;
-      //        area << setiosflags(ios::fixed) <<setprecision(2) << it->area;
-      //        pcl::PointXYZ position;
-      //        position.x = it->mass_center (0);
-      //        position.y = it->mass_center (1);
-      //        position.z = it->mass_center (2);
-      //        viewer.addText3D (area.str (), position, 0.6, 0.0, 0.0, 0.0, area.str (), viewports[1]);
-      //      }
-      //      viewer.spin ();
-    }
-*/
-//    if (amgr.app_options_.color_segments)
-//    {
-//      pViewer->addPointCloud (output, "segments");
-//      pViewer->setPointCloudRenderingProperties    std::vector<double> area;
-//      pViewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_OPACITY, 0.9, "segments");
-//      for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-//      {
-//        if (it->area < 0.5)
-//          continue;
-//        std::ostringstream area, area_full;
-//        area << setiosflags(ios::fixed) << setprecision(2) << it->area;
-//        area_full << it->area;
-//        pcl::PointXYZ position;
-//        position.x = it->mass_center (0);
-//        position.y = it->mass_center (1);
-//        position.z = it->mass_center (2);
-//        pViewer->addText3D (area.str (), position, 0.4, 0.0, 0.0, 0.0, area_full.str (), 0);
-//      }
-//      pViewer->spin();
-//      pViewer->removePointCloud("segments");
-//      for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
-//      {
-//        if (it->area < 0.5)
-//          continue;
-//        std::ostringstream area_full;
-//        area_full << it->area;
-//        pViewer->removeText3D(area_full.str());
-//      }
-//      pViewer->spinOnce (100);
-//    }
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
+  PlanarSegment::StdVectorPtr segments (new PlanarSegment::StdVector (1));
+  SegmentsArea segments_area;
+  segments_area.setSensorResolution (sensor.vertical_resolution, sensor.horizontal_resolution);
+  segments_area.setVerbose (false);
 
-    bool show_normal = false;
-    bool show_area = true;
-    if (amgr.app_options_.color_segments)
+  for (int shape = Convex; shape <= Holed; shape++)
+  {
+    for (size_t si = 0; si < sizes.size (); si++)
     {
-      pViewer->addPointCloud (output, "segments");
-      pViewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "segments");
-      pViewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_OPACITY, 0.9, "segments");
-      for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
+      for (size_t ri = 0; ri < ranges.size (); ri++)
       {
-        if (it->area < 0.2)
-          continue;
-        std::ostringstream area_full;
-        area_full << it->area;
-        if (show_normal)
+        PatchSpec patch;
+        patch.shape = static_cast<PatchShape> (shape);
+        patch.width = sizes[si];
+        patch.height = 0.75 * sizes[si];
+        patch.range = ranges[ri];
+        patch.tilt = tilt * M_PI / 180;
+        PlanarSegment scanned;
+        scanPatch (patch, sensor, rng, *cloud, scanned);
+        if (scanned.point_num < 3)
         {
-          pcl::PointXYZ start, end;
-          start.x = it->mass_center (0);
-          start.y = it->mass_center (1);
-          start.z = it->mass_center (2);
-          end.x = it->mass_center (0) - it->normal (0);
-          end.y = it->mass_center (1) - it->normal (1);
-          end.z = it->mass_center (2) - it->normal (2);
-          pViewer->addArrow(end, start, 0.0, 0.0, 0.0, false, area_full.str ());
-        }
-        if (show_area)
-        {
-          std::ostringstream area;
-          area << setiosflags(ios::fixed) << setprecision(2) << it->area;
-          //area << it - segments->begin ();
-          pcl::PointXYZ position;
-          position.x = it->mass_center (0);
-          position.y = it->mass_center (1);
-          position.z = it->mass_center (2);
-          pViewer->addText3D (area.str (), position, 0.2, 0.0, 0.0, 0.0, area_full.str (), 0);
+          std::cerr << "Skipping a " << shape_names[shape] << " patch of width " << patch.width
+                    << " at " << patch.range << " m, too few points.\n";
+          continue;
         }
-      }
-      pViewer->spin();
-      pViewer->removePointCloud("segments");
-      if (show_normal)
-      {
-        pViewer->removeAllShapes ();
-      }
-      if (show_area)
-      {
-        for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
+        const double true_area = patchArea (patch);
+
+        for (int method = SegmentsArea::SumOfSmallFaces; method <= SegmentsArea::OccupancyGrid; method++)
         {
-          if (it->area < 0.2)
-            continue;
-          std::ostringstream area_full;
-          area_full << it->area;
-          pViewer->removeText3D(area_full.str());
+          /// only SumOfSmallFaces is multi-threaded, the others are run once with a single thread
+          const size_t thread_runs = method == SegmentsArea::SumOfSmallFaces ? thread_counts.size () : 1;
+          for (size_t ti = 0; ti < thread_runs; ti++)
+          {
+            const int threads = method == SegmentsArea::SumOfSmallFaces ? thread_counts[ti] : 1;
+            segments_area.setNumberOfThreads (threads);
+            double best_time = -1.0, area = 0.0;
+            for (int rep = 0; rep < repetitions; rep++)
+            {
+              (*segments)[0] = scanned;
+              struct timeval tpstart, tpend;
+              gettimeofday (&tpstart, NULL);
+              switch (method)
+              {
+                case SegmentsArea::SumOfSmallFaces:
+                  segments_area.areaBySumOfSmallFaces (cloud, segments);
+                  break;
+                case SegmentsArea::DelaunayTriangulation:
+                  segments_area.areaByDelaunayTriangulation (cloud, segments);
+                  break;
+                case SegmentsArea::AlphaShape:
+                  segments_area.areaByAlphaShape (cloud, segments);
+                  break;
+                case SegmentsArea::NumberOfSquareUnits:
+                  segments_area.areaByNumberOfSquareUnits (cloud, segments);
+                  break;
+                case SegmentsArea::OccupancyGrid:
+                  segments_area.areaByOccupancyGrid (cloud, segments);
+                  break;
+              }
+              gettimeofday (&tpend, NULL);
+              double time = elapsedMilliseconds (tpstart, tpend);
+              if (best_time < 0 || time < best_time)
+                best_time = time;
+              area = (*segments)[0].area;
+            }
+            csv << shape_names[shape] << "," << patch.width << "," << patch.height << "," << patch.range << ","
+                << tilt << "," << scanned.point_num << "," << method_names[method] << "," << threads << ","
+                << true_area << "," << area << "," << (area - true_area) / true_area << "," << best_time << "\n";
+          }
         }
+        std::cout << "Benchmarked a " << shape_names[shape] << " patch of width " << patch.width << " at "
+                  << patch.range << " m with " << scanned.point_num << " points.\n";
       }
-      pViewer->spinOnce (100);
     }
-
   }
-  delete pViewer;
+  csv.close ();
+  std::cout << "Results are written to " << output_file << std::endl;
   return (0);
 }
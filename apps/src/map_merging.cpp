@@ -50,6 +50,7 @@
 //TAMS
 #include "abstract_planar_segment/abstract_planar_segment.h";
 #include "segments_area/segments_area.h"
+#include "segments_area/incremental_area.h"
 #include "registration/registration.h"
 #include "octree_region_growing_segmentation/octree_region_growing_segmentation.h"
 #include "application_options_manager/application_options_manager.h"
@@ -176,6 +177,41 @@ main (int argc, char** argv)
        << 0.0f          << " " << " " <<          0.0f << " " <<          0.0f << " " <<           1.0f << std::endl;
   pose.close ();
 
+  /** The planes of the first map are grown by the segments of the second map on the same plane.
+    * Each plane keeps its area in an IncrementalArea, so a merged segment only rasterizes its own points
+    * instead of recomputing the area from all the points of the plane.
+    */
+  double cos_max_angle_diff = cos (amgr.registration_params_.max_angle_diff * M_PI / 180);
+  double max_bias_diff = amgr.registration_params_.max_bias_diff;
+  IncrementalArea::StdVector plane_areas (segments1->size ());
+  for (size_t i = 0; i < segments1->size (); i++)
+    plane_areas[i].addSegment ((*segments1)[i], *cloud1);
+  int merged_num = 0;
+  for (PlanarSegment::StdVector::iterator it = segments2->begin (); it != segments2->end (); it++)
+  {
+    Vector3d normal = rotation * it->normal;
+    double bias = it->bias + normal.dot (translation);
+    Vector3d mass_center = rotation * it->mass_center + translation;
+    for (size_t i = 0; i < segments1->size (); i++)
+    {
+      const PlanarSegment &plane = (*segments1)[i];
+      //the Hessian plane (n,d) is the same as (-n,-d)
+      double side = normal.dot (plane.normal) < 0.0 ? -1.0 : 1.0;
+      if (side * normal.dot (plane.normal) < cos_max_angle_diff || fabs (side * bias - plane.bias) > max_bias_diff)
+        continue;
+      //the segments should overlap, they are approximated by disks of the same area around their mass centers
+      if ((mass_center - plane.mass_center).norm () > sqrt (plane.area / M_PI) + sqrt (it->area / M_PI))
+        continue;
+      plane_areas[i].addPoints (*cloud2, it->points, rotation, translation);
+      merged_num++;
+    }
+  }
+  double raster_area = 0.0;
+  for (size_t i = 0; i < plane_areas.size (); i++)
+    raster_area += plane_areas[i].area ();
+  PCL_INFO ("%d segments of the second map are merged into the planes of the first one, whose raster area is %f m^2 in total.\n",
+            merged_num, raster_area);
+
   if (amgr.registration_params_.visualization)
     registration.visualizeCorrespondences();
 
@@ -0,0 +1,304 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+//STL
+#include <string>
+#include <cmath>
+#include <fstream>
+#include <sys/time.h>
+//boost
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+//PCl
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+//TAMS
+#include "common/common.h"
+#include "abstract_planar_segment/abstract_planar_segment.h"
+#include "segments_area/segments_area.h"
+#include "registration/registration.h"
+#include "octree_region_growing_segmentation/octree_region_growing_segmentation.h"
+#include "application_options_manager/application_options_manager.h"
+#include "pipeline/bounded_queue.h"
+
+/** Pipelined version of the mapper. Three stages run concurrently and are connected by bounded queues:
+  * loading and segmenting the scans, registering each scan to the previous one, and accumulating the
+  * transformed scans into the global map. Scan k+1 is segmented while scan k is registered, so the
+  * throughput approaches the one of the slowest stage.
+  */
+
+using namespace tams;
+using namespace Eigen;
+
+/** a segmented scan, handed from the segmentation stage to the registration stage. */
+struct SegmentedScan
+{
+  int index;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  PlanarSegment::StdVectorPtr segments;
+};
+
+/** a scan with its pose in the frame of the first scan, handed from the registration stage to the accumulation stage. */
+struct PlacedScan
+{
+  int index;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  Matrix3d rotation;
+  Vector3d translation;
+};
+
+/** latency statistics of one stage, only updated by the thread running the stage. */
+struct StageStats
+{
+  StageStats (const std::string &stage_name): name (stage_name), count (0), total (0.0), max (0.0) {}
+
+  void
+  add (double latency)
+  {
+    count++;
+    total += latency;
+    if (latency > max)
+      max = latency;
+  }
+
+  void
+  report (std::ostream &os) const
+  {
+    os << name << ": " << count << " scans, mean latency " << (count > 0 ? total / count : 0.0)
+       << " s, max latency " << max << " s, busy " << total << " s" << std::endl;
+  }
+
+  std::string name;
+  int count;
+  double total;
+  double max;
+};
+
+double
+wallTime ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec * 1e-6);
+}
+
+std::string
+scanName (const ApplicationOptionsManager &amgr, int scan_index)
+{
+  char buf[16];
+  sprintf (buf, "%03d", scan_index);
+  return (amgr.app_options_.organized_pcd_dir + amgr.app_options_.input_prefix + std::string (buf));
+}
+
+/** Load, segment and compute the segment attributes and areas of all scans, in order. */
+void
+segmentScans (const ApplicationOptionsManager &amgr, BoundedQueue<SegmentedScan> &output, StageStats &stats, bool &failed)
+{
+  OctreeRGSegmentation segmenter;
+  segmenter.setParameters (amgr.octree_seg_params_);
+  AbstractPlanarSegment abstract_segment;
+  abstract_segment.setSensorNoiseModel(amgr.sensor_params_.polynomial_noise_a0,
+                                       amgr.sensor_params_.polynomial_noise_a1,
+                                       amgr.sensor_params_.polynomial_noise_a2);
+  pcl::PCDReader pcd_reader;
+
+  for (int scan_index = amgr.app_options_.first_index; scan_index <= amgr.app_options_.last_index; scan_index++)
+  {
+    double start = wallTime ();
+    SegmentedScan scan;
+    scan.index = scan_index;
+    scan.cloud.reset (new pcl::PointCloud<pcl::PointXYZ>);
+    std::string pcd_file = scanName (amgr, scan_index) + ".pcd";
+    if (pcd_reader.read (pcd_file, *scan.cloud) == -1)
+    {
+      PCL_ERROR ("Couldn't read file %s!\n", pcd_file.c_str());
+      failed = true;
+      break;
+    }
+
+    segmenter.setInput (scan.cloud);
+    segmenter.octreeCaching();
+    segmenter.segmentation();
+    for (PlanarSegment::StdVector::iterator it = segmenter.getSegments ()->begin(); it != segmenter.getSegments ()->end(); it++)
+    {
+      abstract_segment.calculateAttributes(it, scan.cloud);
+      it->normal = abstract_segment.normal;
+      it->bias = abstract_segment.d;
+    }
+    SegmentsArea segments_area (scan.cloud, segmenter.getSegments (), SegmentsArea::SumOfSmallFaces);
+    scan.segments.reset (new PlanarSegment::StdVector (segmenter.getSegments ()->begin (), segmenter.getSegments ()->end ()));
+    stats.add (wallTime () - start);
+
+    if (!output.push (scan))
+      break;
+  }
+  output.close ();
+}
+
+/** Write the pose of every scan and add its finite, non-zero points in the frame of the first scan to the map. */
+void
+accumulateScans (const ApplicationOptionsManager &amgr, BoundedQueue<PlacedScan> &input, StageStats &stats,
+                 pcl::PointCloud<pcl::PointXYZ> &map)
+{
+  PlacedScan scan;
+  while (input.pop (scan))
+  {
+    double start = wallTime ();
+    const Matrix3d &rotation = scan.rotation;
+    const Vector3d &translation = scan.translation;
+    std::string pose_file = scanName (amgr, scan.index) + ".pose";
+    std::ofstream pose (pose_file.c_str ());
+    pose << rotation(0,0) << " " << " " << rotation(0,1) << " " << rotation(0,2) << " " << translation(0) << std::endl
+         << rotation(1,0) << " " << " " << rotation(1,1) << " " << rotation(1,2) << " " << translation(1) << std::endl
+         << rotation(2,0) << " " << " " << rotation(2,1) << " " << rotation(2,2) << " " << translation(2) << std::endl
+         << 0.0f          << " " << " " <<          0.0f << " " <<          0.0f << " " <<           1.0f << std::endl;
+    pose.close ();
+
+    Matrix3f rm = rotation.cast<float> ();
+    Vector3f t = translation.cast<float> ();
+    map.points.reserve (map.points.size () + scan.cloud->points.size ());
+    for (size_t i = 0; i < scan.cloud->points.size (); i++)
+    {
+      const pcl::PointXYZ &point = scan.cloud->points[i];
+      if (!pcl_isfinite (point.x) || !pcl_isfinite (point.y) || !pcl_isfinite (point.z))
+        continue;
+      if (point.x == 0 && point.y == 0 && point.z == 0)
+        continue;
+      Vector3f transformed = rm * point.getVector3fMap () + t;
+      map.points.push_back (pcl::PointXYZ (transformed(0), transformed(1), transformed(2)));
+    }
+    map.height = 1;
+    map.width = map.points.size();
+    stats.add (wallTime () - start);
+  }
+}
+
+int
+main (int argc, char** argv)
+{
+  ApplicationOptionsManager amgr;
+  if (!amgr.readOptions (argc, argv))
+    return -1;
+
+  size_t queue_depth = amgr.app_options_.queue_depth;
+  BoundedQueue<SegmentedScan> segmented_scans (queue_depth);
+  BoundedQueue<PlacedScan> placed_scans (queue_depth);
+  StageStats segmentation_stats ("segmentation");
+  StageStats registration_stats ("registration");
+  StageStats accumulation_stats ("accumulation");
+  pcl::PointCloud<pcl::PointXYZ> map;
+  bool failed = false;
+
+  double start = wallTime ();
+  boost::thread segmentation_thread (boost::bind (&segmentScans, boost::cref (amgr), boost::ref (segmented_scans),
+                                                  boost::ref (segmentation_stats), boost::ref (failed)));
+  boost::thread accumulation_thread (boost::bind (&accumulateScans, boost::cref (amgr), boost::ref (placed_scans),
+                                                  boost::ref (accumulation_stats), boost::ref (map)));
+
+  /** the registration runs in the main thread, which also owns the visualization. */
+  Registration registration;
+  registration.setParameters(amgr.registration_params_);
+  SegmentedScan map_scan, data_scan;
+  PlacedScan placed;
+  double path_length = 0.0;
+  if (segmented_scans.pop (map_scan))
+  {
+    registration.setMapCloud(map_scan.cloud);
+    registration.setMapSegments(map_scan.segments);
+    placed.index = map_scan.index;
+    placed.cloud = map_scan.cloud;
+    placed.rotation = Matrix3d::Identity();
+    placed.translation = Vector3d::Zero();
+    placed_scans.push (placed);
+  }
+  while (segmented_scans.pop (data_scan))
+  {
+    double registration_start = wallTime ();
+    registration.setDataCloud(data_scan.cloud);
+    registration.setDataSegments(data_scan.segments);
+    bool registered = registration.execute();
+    std::cout << "length of the step: " << (registration.translation()).norm() << std::endl;
+
+    placed.translation = placed.rotation * registration.translation() + placed.translation;
+    placed.rotation = placed.rotation * registration.rotation();
+    placed.index = data_scan.index;
+    placed.cloud = data_scan.cloud;
+    std::cout << "current position: " << placed.translation.transpose() << std::endl;
+    path_length += registration.translation().norm();
+    registration_stats.add (wallTime () - registration_start);
+    placed_scans.push (placed);
+
+    if (amgr.registration_params_.visualization && registered)
+    {
+      registration.visualizeCorrespondencesWithPoints ();
+    }
+
+    //the current scan becomes the map, the registration keeps its segment pair table
+    map_scan = data_scan;
+    registration.dataAsMap ();
+  }
+  placed_scans.close ();
+  segmentation_thread.join ();
+  accumulation_thread.join ();
+  double elapsed = wallTime () - start;
+
+  std::cout << "length of the path: " << path_length << std::endl;
+  segmentation_stats.report (std::cout);
+  registration_stats.report (std::cout);
+  accumulation_stats.report (std::cout);
+  std::cout << "segmented scans queue: capacity " << segmented_scans.capacity () << ", mean depth " << segmented_scans.meanDepth ()
+            << ", max depth " << segmented_scans.maxDepth () << std::endl;
+  std::cout << "placed scans queue: capacity " << placed_scans.capacity () << ", mean depth " << placed_scans.meanDepth ()
+            << ", max depth " << placed_scans.maxDepth () << std::endl;
+  std::cout << "total time " << elapsed << " s for " << segmentation_stats.count << " scans" << std::endl;
+  if (failed)
+    return (-1);
+
+  pcl::PointCloud<pcl::PointXYZ> downsampled;
+  pcl::VoxelGrid<pcl::PointXYZ> voxel_grid_downsampling;
+  voxel_grid_downsampling.setInputCloud (map.makeShared());
+  voxel_grid_downsampling.setLeafSize (0.1, 0.1, 0.1);
+  voxel_grid_downsampling.filter (downsampled);
+  std::cout << "cloud size after down-sampling: " << downsampled.size () << std::endl;
+
+  pcl::io::savePCDFileBinary("map.pcd", map);
+  pcl::io::savePCDFileBinary("downsampled_map.pcd", downsampled);
+  return 0;
+}
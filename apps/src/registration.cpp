@@ -233,11 +233,10 @@ main (int argc, char** argv)
     }
 
     path_length += registration.translation().norm();
-    *map_cloud = *data_cloud;
-    map_segments->clear();
-    map_segments->insert(map_segments->begin(), data_segments->begin(), data_segments->end());
-    registration.setMapCloud(map_cloud);
-    registration.setMapSegments(map_segments);
+    //the current scan becomes the map, the registration keeps its segment pair table
+    map_cloud.swap (data_cloud);
+    map_segments.swap (data_segments);
+    registration.dataAsMap ();
   }
   std::cout << "length of the path: " << path_length << std::endl;
 
@@ -45,6 +45,9 @@
 #include "fftw_correlate/fftw_correlate.h"
 #include "application_options_manager/application_options_manager.h"
 #include "common/planar_patch.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 int
 main (int argc, char **argv)
@@ -59,11 +62,6 @@ main (int argc, char **argv)
   std::string pcd_prefix = amgr.app_options_.unorganized_pcd_dir + amgr.app_options_.input_prefix;
 
   int bandwidth = 128;
-  int egi_size = 4 * bandwidth * bandwidth;
-  float *egi = new float[egi_size];
-  float egi_resolution_theta = M_PI / (bandwidth * 2);
-  float egi_resolution_phi = M_PI / bandwidth;
-  float theta, phi;
 
   FFTWCorrelate fc;
   pcl::PointCloud<pcl::PointXYZ>::Ptr map_cloud (new pcl::PointCloud<pcl::PointXYZ>);
@@ -72,13 +70,17 @@ main (int argc, char **argv)
   std::vector<pcl::PointXYZ> points;
   boost::timer t;
 
-  fc.setBandWidth (128, 128, 127);
+  fc.setBandWidth (bandwidth, bandwidth, bandwidth - 1);
+  //the plans are measured once and reused from the wisdom file by later runs
+  fc.setWisdomFile ("fftw_wisdom_bw128");
+#ifdef _OPENMP
+  fc.setThreadNum (omp_get_max_threads ());
+#endif
   t.restart();
   fc.initialize();
 
   for (size_t scan_index = amgr.app_options_.first_index; scan_index <= amgr.app_options_.last_index; scan_index++)
   {
-    memset(egi, 0.0, egi_size * sizeof(float));
     char buf[4];
     sprintf(buf,"%03d", scan_index);
     std::string map_file = pcd_prefix + std::string (buf) + ".pcd";
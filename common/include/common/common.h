@@ -78,6 +78,19 @@ namespace tams
 													 double &yaw,
 													 double tolerance = M_PI/18000.0 );
 
+  /** \brief Transform a point cloud by a rotation and a translation, four coordinates at once with SSE
+   * if available. The output may be the input.
+   * \param[in] input the given point cloud
+   * \param[out] output the transformed point cloud
+   * \param[in] rotation the 3X3 rotation matrix
+   * \param[in] translation the translation, applied after the rotation
+   */
+  void
+  transformPointcloud (const pcl::PointCloud<pcl::PointXYZ> &input,
+                       pcl::PointCloud<pcl::PointXYZ> &output,
+                       const Eigen::Matrix3f &rotation,
+                       const Eigen::Vector3f &translation = Eigen::Vector3f::Zero ());
+
 }
 
 #endif
@@ -37,6 +37,9 @@
  *
  */
 #include "common/common.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 namespace tams
 {
@@ -273,4 +276,47 @@ namespace tams
     return ret;
   }
 
+
+  void
+  transformPointcloud (const pcl::PointCloud<pcl::PointXYZ> &input,
+                       pcl::PointCloud<pcl::PointXYZ> &output,
+                       const Eigen::Matrix3f &rotation,
+                       const Eigen::Vector3f &translation)
+  {
+    if (&output != &input)
+    {
+      output.points.resize (input.points.size ());
+      output.width = input.width;
+      output.height = input.height;
+      output.is_dense = input.is_dense;
+    }
+    const size_t point_num = input.points.size ();
+#ifdef __SSE__
+    //the columns of the rotation, and the translation with 1 for the padding of the points
+    const __m128 c0 = _mm_setr_ps (rotation(0,0), rotation(1,0), rotation(2,0), 0.0f);
+    const __m128 c1 = _mm_setr_ps (rotation(0,1), rotation(1,1), rotation(2,1), 0.0f);
+    const __m128 c2 = _mm_setr_ps (rotation(0,2), rotation(1,2), rotation(2,2), 0.0f);
+    const __m128 t = _mm_setr_ps (translation(0), translation(1), translation(2), 1.0f);
+    for (size_t i = 0; i < point_num; i++)
+    {
+      __m128 p = _mm_loadu_ps (input.points[i].data);
+      __m128 r = _mm_add_ps (t, _mm_mul_ps (c0, _mm_shuffle_ps (p, p, _MM_SHUFFLE (0, 0, 0, 0))));
+      r = _mm_add_ps (r, _mm_mul_ps (c1, _mm_shuffle_ps (p, p, _MM_SHUFFLE (1, 1, 1, 1))));
+      r = _mm_add_ps (r, _mm_mul_ps (c2, _mm_shuffle_ps (p, p, _MM_SHUFFLE (2, 2, 2, 2))));
+      _mm_storeu_ps (output.points[i].data, r);
+    }
+#else
+    for (size_t i = 0; i < point_num; i++)
+    {
+      const pcl::PointXYZ &p = input.points[i];
+      float x = rotation(0,0) * p.x + rotation(0,1) * p.y + rotation(0,2) * p.z + translation(0);
+      float y = rotation(1,0) * p.x + rotation(1,1) * p.y + rotation(1,2) * p.z + translation(1);
+      float z = rotation(2,0) * p.x + rotation(2,1) * p.y + rotation(2,2) * p.z + translation(2);
+      output.points[i].x = x;
+      output.points[i].y = y;
+      output.points[i].z = z;
+    }
+#endif
+  }
+
 }
@@ -51,11 +51,15 @@
 #include <pcl/surface/mls.h>
 #include <boost/timer.hpp>
 #include <string>
+#include <vector>
 #include <cmath>
 #include <fstream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <new>
 #include <fftw3.h>
+#include <Eigen/Core>
+#include "common/common.h"
 
 
 extern "C"
@@ -71,6 +75,92 @@ extern "C"
 #include "fftw_correlate/softFFTWCorrelateReal.h"
 }
 
+/** \brief Spherical harmonic coefficients of an Extended Gaussian Image at one bandwidth,
+  * i.e. the result of the forward S^2 transform, which can be reused for many correlations.
+  */
+struct SphericalSpectrum
+{
+  SphericalSpectrum () : bandwidth (0) {}
+  int bandwidth;
+  std::vector<double> real;
+  std::vector<double> imag;
+};
+
+/** \brief Maximum of the SO(3) correlation of two spectra, the Euler angles (z-y-z) rotate the
+  * signal to the pattern, the value is the squared magnitude of the correlation at the maximum.
+  * The peak-to-sidelobe ratio measures how distinct the maximum is from the rest of the correlation.
+  */
+struct CorrelationPeak
+{
+  CorrelationPeak () : value (0.0), psr (0.0), alpha (0.0), beta (0.0), gamma (0.0) {}
+  double value;
+  double psr;
+  float alpha;
+  float beta;
+  float gamma;
+};
+
+/** \brief Owned array of plain values, aligned to 64 bytes (a cache line, and wide enough for any SIMD
+  * load). Resizing keeps the storage as long as it is large enough, so buffers sized from the bandwidth
+  * are allocated once and reused for every scan.
+  */
+template <typename T>
+class AlignedBuffer
+{
+public:
+  AlignedBuffer () : raw_ (NULL), data_ (NULL), size_ (0), capacity_ (0) {}
+  ~AlignedBuffer ()
+  {
+    free (raw_);
+  }
+
+  /** \brief Resize the buffer, the content is undefined if the storage had to grow. */
+  void
+  resize (size_t size)
+  {
+    if (size > capacity_)
+    {
+      free (raw_);
+      raw_ = malloc (size * sizeof (T) + ALIGNMENT - 1);
+      if (raw_ == NULL)
+        throw std::bad_alloc ();
+      size_t address = reinterpret_cast<size_t> (raw_);
+      data_ = reinterpret_cast<T*> ((address + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+      capacity_ = size;
+    }
+    size_ = size;
+  }
+
+  T*
+  data ()
+  {
+    return (data_);
+  }
+
+  const T*
+  data () const
+  {
+    return (data_);
+  }
+
+  size_t
+  size () const
+  {
+    return (size_);
+  }
+
+  static const size_t ALIGNMENT = 64;
+
+private:
+  AlignedBuffer (const AlignedBuffer&);
+  AlignedBuffer& operator= (const AlignedBuffer&);
+
+  void *raw_;
+  T *data_;
+  size_t size_;
+  size_t capacity_;
+};
+
 /** \brief @b FFTWCorrelate represents the relative rotation estimation class.
   * Given two cloud points, this class estimation their relative rotation as Euler angles.
   * \author Junhao Xiao
@@ -83,23 +173,27 @@ public:
   /** \brief empty construction.*/
   FFTWCorrelate():
     bwIn_(0), bwOut_(0), bwLimit_(0),
+    alpha_ (0.0), beta_ (0.0), gamma_ (0.0),
     cloud_map_ (new pcl::PointCloud<pcl::PointXYZ>),
     cloud_data_ (new pcl::PointCloud<pcl::PointXYZ>),
     rotated_cloud_data_ (new pcl::PointCloud<pcl::PointXYZ>),
-    rm_(new float [9])
+    context_ (NULL),
+    map_spectrum_valid_ (false),
+    data_spectrum_valid_ (false),
+    thread_num_ (1),
+    batch_thread_num_ (1),
+    coarse_bandwidth_ (0),
+    candidate_num_ (5),
+    coarse_context_ (NULL)
   {
   }
-  /** \brief empty destruction*/
+  /** \brief destroy the correlation contexts, the buffers are released by their owners. */
   ~FFTWCorrelate()
   {
-    if (rm_ != NULL)
-      delete [] rm_;
-    if (egi_map_ != NULL)
-      delete [] egi_map_;
-    if (egi_data_ != NULL)
-      delete [] egi_data_;
-    if (rms_ != NULL)
-      delete [] rms_;
+    softCorrelationContextDestroy (context_);
+    for (size_t i = 0; i < batch_contexts_.size (); i++)
+      softCorrelationContextDestroy (batch_contexts_[i]);
+    softCorrelationContextDestroy (coarse_context_);
   }
 
   /** \brief Set the cloud which will be used as a reference map.
@@ -133,10 +227,116 @@ public:
     bwLimit_ = bwLimit;
   }
 
-  /** \brief Get the rotation (as Euler angles) between two clouds with overlapping. */
+  /** \brief Set a file to load FFTW wisdom from and save it to, before initialize ().
+   * With wisdom the plans are measured, which is only slow the first time.
+   * \param[in] wisdom_file name of the wisdom file, empty for estimated plans without wisdom
+   */
+  void
+  setWisdomFile(const std::string &wisdom_file)
+  {
+    wisdom_file_ = wisdom_file;
+  }
+
+  /** \brief Set the number of threads of a single correlation, before initialize ().
+   * They share the many-DFT stage of the inverse SO(3) transform (if the library is linked
+   * with fftw3_threads) and the search of its maximum (with OpenMP).
+   * \param[in] thread_num number of threads
+   * \todo The Wigner-d combination of the inverse SO(3) transform (Inverse_SO3_Naive_fftw, compiled from the
+   * SOFT sources) is still serial, and there is no fftwf single-precision build, both need changes to these sources.
+   */
+  void
+  setThreadNum (int thread_num)
+  {
+    thread_num_ = thread_num > 0 ? thread_num : 1;
+  }
+
+  /** \brief Get the rotation (as Euler angles) between two clouds with overlapping.
+   * The spectrum of the map is only computed if the map EGI changed since the last call.
+   */
   void
   softFFTWCorrelateReal();
 
+  /** \brief Get the largest local maxima of the correlation between map and data, in one correlation.
+   * If the largest one is ambiguous, e.g. in symmetric buildings or corridors, the others are the
+   * rotation hypotheses to evaluate. The angles of the largest one are kept as the result.
+   * \param[in] peak_num the maximum number of maxima
+   * \param[out] peaks the maxima with their peak-to-sidelobe ratios, largest first
+   */
+  void
+  softFFTWCorrelatePeaks (int peak_num, std::vector<CorrelationPeak> &peaks);
+
+  /** \brief Forward transform the map EGI, the result is cached for the following correlations. */
+  void
+  computeMapSpectrum ();
+
+  /** \brief Get the cached spectrum of the map, e.g. to share it with other correlators. */
+  const SphericalSpectrum&
+  getMapSpectrum () const
+  {
+    return (map_spectrum_);
+  }
+
+  /** \brief Use the given spectrum as the map, instead of transforming the map EGI.
+   * \param[in] spectrum spectrum of the reference map, its bandwidth has to be the input bandwidth
+   */
+  void
+  setMapSpectrum (const SphericalSpectrum &spectrum);
+
+  /** \brief Forward transform the data EGI, e.g. to keep it as the spectrum of a keyframe. */
+  void
+  computeDataSpectrum ();
+
+  /** \brief Get the spectrum of the data, valid after computeDataSpectrum () or a correlation. */
+  const SphericalSpectrum&
+  getDataSpectrum () const
+  {
+    return (data_spectrum_);
+  }
+
+  /** \brief Set the number of threads used by correlateBatch ().
+   * Every additional thread has its own single-threaded context, which holds two arrays of 8*bw^3 complex numbers.
+   * The first thread uses the context of the single correlations, or its own one if setThreadNum () made that
+   * context multi-threaded, so that the batch does not run more than thread_num threads.
+   * \param[in] thread_num number of threads, ignored without OpenMP
+   */
+  void
+  setBatchThreadNum (int thread_num)
+  {
+    batch_thread_num_ = thread_num > 0 ? thread_num : 1;
+  }
+
+  /** \brief Correlate one pattern with many signals, e.g. a new scan with the last keyframes
+   * to rank loop closure candidates. The signals are correlated in parallel.
+   * \param[in] pattern spectrum of the pattern, i.e. the new scan
+   * \param[in] signals spectra of the signals, i.e. the candidates
+   * \param[out] peaks the correlation maximum for every signal, in the order of the signals,
+   *             whose peak-to-sidelobe ratios can rank the candidates
+   */
+  void
+  correlateBatch (const SphericalSpectrum &pattern,
+                  const std::vector<SphericalSpectrum> &signals,
+                  std::vector<CorrelationPeak> &peaks);
+
+  /** \brief Settings of the coarse-to-fine search, before initialize ().
+   * \param[in] coarse_bandwidth bandwidth of the correlation on the coarsest level,
+   *            the input bandwidth divided by a power of two, 0 to disable the search
+   * \param[in] candidate_num number of maxima of the coarse correlation to refine
+   */
+  void
+  setPyramid (int coarse_bandwidth, int candidate_num)
+  {
+    coarse_bandwidth_ = coarse_bandwidth;
+    candidate_num_ = candidate_num > 0 ? candidate_num : 1;
+  }
+
+  /** \brief Get the rotation (as Euler angles) between two clouds with a coarse-to-fine search.
+   * The largest maxima of a correlation at the coarse bandwidth are refined on the EGIs of the
+   * finer levels, up to the input bandwidth, by a local search of the rotation, followed by a
+   * parabolic interpolation between the bins of the finest level.
+   */
+  void
+  softFFTWCorrelatePyramid ();
+
   /**
    * @b Construct EGI from octree planar segmentation or planar segmentation.
    * @param segments_file
@@ -144,7 +344,8 @@ public:
   void
   mapConstellationImage(const std::string segments_file)
   {
-    constellationImage(segments_file, bwIn_, egi_map_);
+    constellationImage(segments_file, bwIn_, egi_map_.data ());
+    map_spectrum_valid_ = false;
   }
 
   /**
@@ -154,8 +355,34 @@ public:
   void
   dataConstellationImage(const std::string segments_file)
   {
-    constellationImage(segments_file, bwIn_, egi_data_);
+    constellationImage(segments_file, bwIn_, egi_data_.data ());
+    data_spectrum_valid_ = false;
   }
+
+  /**
+   * @b Construct EGI from planar segments in memory.
+   * @param segments the planar segments of the map
+   * @param soft_binning whether to spread the areas by the normal covariances, see constellationImage
+   */
+  void
+  mapConstellationImage(const tams::PlanarSegment::StdVector &segments, bool soft_binning = false)
+  {
+    constellationImage(segments, bwIn_, egi_map_.data (), soft_binning);
+    map_spectrum_valid_ = false;
+  }
+
+  /**
+   * @b Construct EGI from planar segments in memory.
+   * @param segments the planar segments of the data
+   * @param soft_binning whether to spread the areas by the normal covariances, see constellationImage
+   */
+  void
+  dataConstellationImage(const tams::PlanarSegment::StdVector &segments, bool soft_binning = false)
+  {
+    constellationImage(segments, bwIn_, egi_data_.data (), soft_binning);
+    data_spectrum_valid_ = false;
+  }
+
   /** \brief construct the constellation Images for map and data cloud.
    * */
   void
@@ -163,6 +390,19 @@ public:
                      const int bandwidth,
                      float *egi);
 
+  /** \brief construct the constellation Image of planar segments, i.e. their areas binned by their normals.
+   * \param[in] segments the planar segments
+   * \param[in] bandwidth the bandwidth of the image
+   * \param[out] egi the resulted image
+   * \param[in] soft_binning if true, the area of a segment is spread over the neighbouring bins by a Gaussian
+   *            with its normal covariance (Cnn); segments without covariance are binned into a single bin
+   */
+  void
+  constellationImage(const tams::PlanarSegment::StdVector &segments,
+                     const int bandwidth,
+                     float *egi,
+                     bool soft_binning = false);
+
   /** \brief construct Extended Gaussian Image for the cloud whose coordinate system as reference.*/
   void
   egiMap (bool organized,
@@ -193,7 +433,7 @@ public:
                 const bool organized,
                 const bool write2file,
                 const bool visualization);
-  /**@b Extended Gaussian Image computation for organized point cloud.
+  /**@b Extended Gaussian Image computation for organized point cloud, see egiFromOrganizedCloud.
    *
    * @param[in] cloud boost shared pointer to the given organized point cloud
    * @param[out] egi pointer to the resulted Extended Gaussian Image
@@ -205,11 +445,27 @@ public:
                 float *egi,
                 const int bandwidth,
                 const bool visualization);
+  /**@b Fast Extended Gaussian Image computation for organized point cloud. The normal of every pixel
+   * is the cross product of the central differences of its neighbours, and weighted by the surface
+   * area of the pixel; pixels at jump edges are skipped. The bins are filled by all threads into
+   * their own histograms, which are kept for the next call.
+   *
+   * @param[in] cloud the given organized point cloud
+   * @param[out] egi pointer to the resulted Extended Gaussian Image
+   * @param[in] bandwidth for forward spherical harmonics transform
+   * @param[in] pixel_step distance of the neighbours in pixels, larger values reduce the noise
+   */
+  void
+  egiFromOrganizedCloud(const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                        float *egi,
+                        const int bandwidth,
+                        const int pixel_step = 2);
+
   /**
-   * @b Rotate a given point cloud with given rotation matrix in SO(3).
+   * @b Rotate a given point cloud with given rotation matrix in SO(3), see tams::transformPointcloud.
    * @param[in] input boost shared pointer to the given point cloud which will be rotated
    * @param[out] output boost shared pointer to the output (rotated) point cloud
-   * @param[in] rm pointer to the rotation matrix (float [9])
+   * @param[in] rm pointer to the rotation matrix (float [9], row major)
    */
   void
   rotatePointcloud(pcl::PointCloud<pcl::PointXYZ>::Ptr input,
@@ -236,7 +492,42 @@ public:
                                 const float gamma);
 
   /**
-   * @b construct the rotation matrix table.
+   * @b Construct a 3D rotation matrix from given Euler angles (in z-y-z turn), e.g. of a correlation peak.
+   * @param[in] alpha the first Euler angle
+   * @param[in] beta the second Euler angle
+   * @param[in] gamma the third Euler angle
+   */
+  static Eigen::Matrix3f
+  rotationFromEulerAngles(const float alpha,
+                          const float beta,
+                          const float gamma);
+
+  /**
+   * @b Euler angles (in z-y-z turn) of a rotation matrix, the inverse of rotationFromEulerAngles.
+   * In the singular cases beta = 0 and beta = pi, gamma is set to 0.
+   * @param[in] rotation the rotation matrix
+   * @param[out] alpha the first Euler angle, in [0, 2pi)
+   * @param[out] beta the second Euler angle, in [0, pi]
+   * @param[out] gamma the third Euler angle, in [0, 2pi)
+   */
+  static void
+  eulerAnglesFromRotation (const Eigen::Matrix3f &rotation,
+                           float &alpha,
+                           float &beta,
+                           float &gamma);
+
+  /**
+   * @b Get the rotation of the last correlation, evaluated from its Euler angles.
+   */
+  Eigen::Matrix3f
+  getRotation () const
+  {
+    return (rotationFromEulerAngles (alpha_, beta_, gamma_));
+  }
+
+  /**
+   * @b Allocate the EGIs and create the correlation context for the input bandwidth,
+   * whose FFTW plans, Legendre tables and workspaces are reused by every correlation.
    */
   void
   initialize ();
@@ -250,16 +541,11 @@ public:
   visualize();
 
   /**
-   * @b step to next point cloud.
+   * @b step to next point cloud, the spectrum of the data becomes the one of the map.
    */
   void
   dataAsMap ();
 
-  /**
-   * @b tmp
-   */
-  void test ();
-
 private:
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_map_;
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_data_;
@@ -270,10 +556,64 @@ private:
   float alpha_;
   float beta_;
   float gamma_;
-  float *rm_;
-  float *egi_map_;
-  float *egi_data_;
-  float *rms_;
+  float rm_[9];
+  AlignedBuffer<float> egi_map_;
+  AlignedBuffer<float> egi_data_;
+  SoftCorrelationContext *context_;
+  std::string wisdom_file_;
+  SphericalSpectrum map_spectrum_;
+  SphericalSpectrum data_spectrum_;
+  bool map_spectrum_valid_;
+  bool data_spectrum_valid_;
+  int thread_num_;
+  int batch_thread_num_;
+  std::vector<SoftCorrelationContext*> batch_contexts_;
+  std::vector<std::vector<float> > egi_histograms_;
+  std::vector<std::pair<int, double> > binning_weights_;
+
+  /** \brief EGIs of the map and the data at one bandwidth of the pyramid. */
+  struct PyramidLevel
+  {
+    int bandwidth;
+    /** \brief the map EGI */
+    std::vector<float> map;
+    /** \brief the map EGI, smoothed to widen the basin of the local search */
+    std::vector<float> smoothed_map;
+    /** \brief the data EGI */
+    std::vector<float> data;
+    /** \brief directions and weights (value times area) of the non empty data bins */
+    std::vector<Eigen::Vector3d> data_directions;
+    std::vector<double> data_weights;
+  };
+
+  /** \brief Build the levels of the pyramid from the EGIs at the input bandwidth. */
+  void
+  buildPyramid ();
+
+  /** \brief Correlation of the map and the data rotated by the given rotation on one level. */
+  double
+  levelCorrelation (const PyramidLevel &level, const Eigen::Matrix3d &rotation) const;
+
+  /** \brief Improve the rotation by a local search on one level.
+   * \param[in] level the level of the pyramid
+   * \param[in] interpolate whether to finish with a parabolic interpolation
+   * \param[in,out] rotation the rotation of the data to the map
+   * \param[out] value the correlation at the resulted rotation
+   */
+  void
+  refineOnLevel (const PyramidLevel &level,
+                 bool interpolate,
+                 Eigen::Matrix3d &rotation,
+                 double &value) const;
+
+  int coarse_bandwidth_;
+  int candidate_num_;
+  SoftCorrelationContext *coarse_context_;
+  std::vector<PyramidLevel> pyramid_;
+
+  /** \brief not copyable, the correlation contexts are owned. */
+  FFTWCorrelate (const FFTWCorrelate&);
+  FFTWCorrelate& operator= (const FFTWCorrelate&);
 };
 
 #endif
@@ -40,6 +40,68 @@
 #ifndef _softFFTWCorrelate_H
 #define _softFFTWCorrelate_H
 
+#include "fftw3.h"
+
+/* plans, tables and workspaces of the SO(3) correlation at one bandwidth */
+typedef struct
+{
+  int bw ;
+  int nthreads ;
+  double *tmpR, *tmpI ;
+  double *sigCoefR, *sigCoefI ;
+  double *patCoefR, *patCoefI ;
+  fftw_complex *so3Sig, *so3Coef ;
+  fftw_complex *workspace1, *workspace2 ;
+  double *workspace3 ;
+  double *weights ;
+  double *seminaive_naive_tablespace ;
+  double **seminaive_naive_table ;
+  fftw_plan dctPlan, fftPlan, p1 ;
+} SoftCorrelationContext ;
+
+extern SoftCorrelationContext *softCorrelationContextCreate( int ,
+							      const char * ,
+							      int ) ;
+
+extern void softCorrelationContextDestroy( SoftCorrelationContext * ) ;
+
+extern void softSphericalTransform( SoftCorrelationContext * ,
+				    float * ,
+				    double * ,
+				    double * ,
+				    int ) ;
+
+extern double softFFTWCorrelateCoef( SoftCorrelationContext * ,
+				     const double * ,
+				     const double * ,
+				     const double * ,
+				     const double * ,
+				     float * ,
+				     float * ,
+				     float * ,
+				     int ) ;
+
+extern int softFFTWCorrelatePeaks( SoftCorrelationContext * ,
+				   const double * ,
+				   const double * ,
+				   const double * ,
+				   const double * ,
+				   int ,
+				   float * ,
+				   float * ,
+				   float * ,
+				   double * ,
+				   double * ,
+				   int ) ;
+
+extern void softFFTWCorrelateContext( SoftCorrelationContext * ,
+				      float * ,
+				      float * ,
+				      float * ,
+				      float * ,
+				      float * ,
+				      int ) ;
+
 extern void softFFTWCorrelate( int ,
 			  float * ,
 			  float * ,
@@ -40,32 +40,399 @@
 #include "fftw_correlate/fftw_correlate.h"
 #include <Eigen/Core>
 #include <Eigen/SVD>
+#include <Eigen/Geometry>
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 void
 FFTWCorrelate::softFFTWCorrelateReal()
 {
   float tstart = csecond ();
   FILE *fp;
-  softFFTWCorrelate(bwIn_, egi_map_, egi_data_, &alpha_, &beta_, &gamma_, 1) ;
+  if (context_ == NULL)
+  {
+    PCL_ERROR ("The correlation context is not initialized!\n");
+    return;
+  }
+  if (!map_spectrum_valid_)
+    computeMapSpectrum ();
+  computeDataSpectrum ();
+  softFFTWCorrelateCoef (context_,
+                         &map_spectrum_.real[0], &map_spectrum_.imag[0],
+                         &data_spectrum_.real[0], &data_spectrum_.imag[0],
+                         &alpha_, &beta_, &gamma_, 1);
   printf("alpha = %f\nbeta = %f\ngamma = %f\n", alpha_, beta_, gamma_);
   float tstop = csecond ();
   PCL_INFO ("%f seconds elapsed.\n", tstop - tstart);
   return;
 }
 
+void
+FFTWCorrelate::softFFTWCorrelatePeaks (int peak_num, std::vector<CorrelationPeak> &peaks)
+{
+  peaks.clear ();
+  if (context_ == NULL)
+  {
+    PCL_ERROR ("The correlation context is not initialized!\n");
+    return;
+  }
+  if (peak_num <= 0)
+    return;
+  if (!map_spectrum_valid_)
+    computeMapSpectrum ();
+  computeDataSpectrum ();
+  std::vector<float> alphas (peak_num), betas (peak_num), gammas (peak_num);
+  std::vector<double> values (peak_num), psrs (peak_num);
+  int found = ::softFFTWCorrelatePeaks (context_,
+                                        &map_spectrum_.real[0], &map_spectrum_.imag[0],
+                                        &data_spectrum_.real[0], &data_spectrum_.imag[0],
+                                        peak_num, &alphas[0], &betas[0], &gammas[0], &values[0], &psrs[0], 1);
+  peaks.resize (found);
+  for (int i = 0; i < found; i++)
+  {
+    peaks[i].value = values[i];
+    peaks[i].psr = psrs[i];
+    peaks[i].alpha = alphas[i];
+    peaks[i].beta = betas[i];
+    peaks[i].gamma = gammas[i];
+    PCL_INFO ("peak %d: alpha = %f, beta = %f, gamma = %f, psr = %f\n", i, alphas[i], betas[i], gammas[i], psrs[i]);
+  }
+  if (found > 0)
+  {
+    alpha_ = alphas[0];
+    beta_ = betas[0];
+    gamma_ = gammas[0];
+  }
+}
+
+void
+FFTWCorrelate::computeMapSpectrum ()
+{
+  if (context_ == NULL)
+  {
+    PCL_ERROR ("The correlation context is not initialized!\n");
+    return;
+  }
+  softSphericalTransform (context_, egi_map_.data (), &map_spectrum_.real[0], &map_spectrum_.imag[0], 1);
+  map_spectrum_valid_ = true;
+}
+
+void
+FFTWCorrelate::setMapSpectrum (const SphericalSpectrum &spectrum)
+{
+  if (spectrum.bandwidth != bwIn_)
+  {
+    PCL_ERROR ("The map spectrum has bandwidth %d, but %d is used!\n", spectrum.bandwidth, bwIn_);
+    return;
+  }
+  map_spectrum_ = spectrum;
+  map_spectrum_valid_ = true;
+}
+
+void
+FFTWCorrelate::computeDataSpectrum ()
+{
+  if (context_ == NULL)
+  {
+    PCL_ERROR ("The correlation context is not initialized!\n");
+    return;
+  }
+  softSphericalTransform (context_, egi_data_.data (), &data_spectrum_.real[0], &data_spectrum_.imag[0], 1);
+  data_spectrum_valid_ = true;
+}
+
+void
+FFTWCorrelate::correlateBatch (const SphericalSpectrum &pattern,
+                               const std::vector<SphericalSpectrum> &signals,
+                               std::vector<CorrelationPeak> &peaks)
+{
+  peaks.assign (signals.size (), CorrelationPeak ());
+  if (signals.empty ())
+    return;
+  if (context_ == NULL)
+  {
+    PCL_ERROR ("The correlation context is not initialized!\n");
+    return;
+  }
+  if (pattern.bandwidth != bwIn_)
+  {
+    PCL_ERROR ("The pattern spectrum has bandwidth %d, but %d is used!\n", pattern.bandwidth, bwIn_);
+    return;
+  }
+  for (size_t i = 0; i < signals.size (); i++)
+  {
+    if (signals[i].bandwidth != bwIn_)
+    {
+      PCL_ERROR ("The spectrum of signal %d has bandwidth %d, but %d is used!\n",
+                 static_cast<int> (i), signals[i].bandwidth, bwIn_);
+      return;
+    }
+  }
+
+  int thread_num = 1;
+#ifdef _OPENMP
+  thread_num = std::min (batch_thread_num_, static_cast<int> (signals.size ()));
+#endif
+  //the plans of the additional contexts are created here, since FFTW planning is not thread safe;
+  //the candidates are already parallel, so their correlations are single threaded. The first thread
+  //only uses the context of the single correlations if that one is single threaded or the batch is not parallel.
+  int shared_num = (thread_num > 1 && thread_num_ > 1) ? 0 : 1;
+  while (static_cast<int> (batch_contexts_.size ()) < thread_num - shared_num)
+  {
+    SoftCorrelationContext *context =
+        softCorrelationContextCreate (bwIn_, wisdom_file_.empty () ? NULL : wisdom_file_.c_str (), 1);
+    if (context == NULL)
+      break;
+    batch_contexts_.push_back (context);
+  }
+  thread_num = std::min (thread_num, static_cast<int> (batch_contexts_.size ()) + shared_num);
+  if (thread_num == 0)
+  {
+    thread_num = 1;
+    shared_num = 1;
+  }
+
+  const int signal_num = static_cast<int> (signals.size ());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads (thread_num) schedule (dynamic)
+#endif
+  for (int i = 0; i < signal_num; i++)
+  {
+    int thread_id = 0;
+#ifdef _OPENMP
+    thread_id = omp_get_thread_num ();
+#endif
+    SoftCorrelationContext *context = thread_id < shared_num ? context_ : batch_contexts_[thread_id - shared_num];
+    CorrelationPeak &peak = peaks[i];
+    ::softFFTWCorrelatePeaks (context,
+                              &signals[i].real[0], &signals[i].imag[0],
+                              &pattern.real[0], &pattern.imag[0],
+                              1, &peak.alpha, &peak.beta, &peak.gamma, &peak.value, &peak.psr, 1);
+  }
+}
+
+void
+FFTWCorrelate::softFFTWCorrelatePyramid ()
+{
+  float tstart = csecond ();
+  if (coarse_context_ == NULL)
+  {
+    PCL_ERROR ("The coarse-to-fine search is not initialized!\n");
+    return;
+  }
+  buildPyramid ();
+
+  //maxima of the correlation on the coarsest level
+  const PyramidLevel &coarse = pyramid_.front ();
+  const int coef_num = coarse.bandwidth * coarse.bandwidth;
+  std::vector<double> map_real (coef_num), map_imag (coef_num);
+  std::vector<double> data_real (coef_num), data_imag (coef_num);
+  softSphericalTransform (coarse_context_, &pyramid_.front ().map[0], &map_real[0], &map_imag[0], 1);
+  softSphericalTransform (coarse_context_, &pyramid_.front ().data[0], &data_real[0], &data_imag[0], 1);
+  std::vector<float> alphas (candidate_num_), betas (candidate_num_), gammas (candidate_num_);
+  std::vector<double> values (candidate_num_);
+  int peak_num = ::softFFTWCorrelatePeaks (coarse_context_,
+                                           &map_real[0], &map_imag[0],
+                                           &data_real[0], &data_imag[0],
+                                           candidate_num_, &alphas[0], &betas[0], &gammas[0], &values[0], NULL, 1);
+
+  //refine every candidate down the pyramid and keep the best one
+  double best_value = -1.0;
+  Eigen::Matrix3d best_rotation = Eigen::Matrix3d::Identity ();
+  for (int i = 0; i < peak_num; i++)
+  {
+    Eigen::Matrix3d rotation = rotationFromEulerAngles (alphas[i], betas[i], gammas[i]).cast<double> ();
+    double value = 0.0;
+    for (size_t l = pyramid_.size () > 1 ? 1 : 0; l < pyramid_.size (); l++)
+      refineOnLevel (pyramid_[l], l + 1 == pyramid_.size (), rotation, value);
+    if (value > best_value)
+    {
+      best_value = value;
+      best_rotation = rotation;
+    }
+  }
+
+  eulerAnglesFromRotation (best_rotation.cast<float> (), alpha_, beta_, gamma_);
+  printf("alpha = %f\nbeta = %f\ngamma = %f\n", alpha_, beta_, gamma_);
+  float tstop = csecond ();
+  PCL_INFO ("%f seconds elapsed for %d candidates.\n", tstop - tstart, peak_num);
+}
+
+void
+FFTWCorrelate::buildPyramid ()
+{
+  int level_num = 1;
+  for (int bandwidth = coarse_bandwidth_; bandwidth < bwIn_; bandwidth *= 2)
+    level_num++;
+  pyramid_.resize (level_num);
+
+  //the finest level is the input, every coarser level sums up 2x2 bins of the finer one
+  PyramidLevel &finest = pyramid_.back ();
+  finest.bandwidth = bwIn_;
+  finest.map.assign (egi_map_.data (), egi_map_.data () + egi_map_.size ());
+  finest.data.assign (egi_data_.data (), egi_data_.data () + egi_data_.size ());
+  for (int l = level_num - 2; l >= 0; l--)
+  {
+    const PyramidLevel &fine = pyramid_[l + 1];
+    PyramidLevel &level = pyramid_[l];
+    level.bandwidth = fine.bandwidth / 2;
+    int width = 2 * level.bandwidth;
+    level.map.assign (width * width, 0.0);
+    level.data.assign (width * width, 0.0);
+    for (int u = 0; u < 2 * width; u++)
+    {
+      for (int v = 0; v < 2 * width; v++)
+      {
+        level.map[(u / 2) * width + v / 2] += fine.map[u * 2 * width + v];
+        level.data[(u / 2) * width + v / 2] += fine.data[u * 2 * width + v];
+      }
+    }
+  }
+
+  for (int l = 0; l < level_num; l++)
+  {
+    PyramidLevel &level = pyramid_[l];
+    int width = 2 * level.bandwidth;
+    //smooth the map with a [1 2 1] / 4 kernel, periodic in phi
+    std::vector<float> tmp (level.map.size ());
+    level.smoothed_map.resize (level.map.size ());
+    for (int u = 0; u < width; u++)
+    {
+      for (int v = 0; v < width; v++)
+      {
+        tmp[u * width + v] = 0.25 * level.map[u * width + (v + width - 1) % width]
+                           + 0.5 * level.map[u * width + v]
+                           + 0.25 * level.map[u * width + (v + 1) % width];
+      }
+    }
+    for (int u = 0; u < width; u++)
+    {
+      for (int v = 0; v < width; v++)
+      {
+        level.smoothed_map[u * width + v] = 0.25 * tmp[std::max (u - 1, 0) * width + v]
+                                 + 0.5 * tmp[u * width + v]
+                                 + 0.25 * tmp[std::min (u + 1, width - 1) * width + v];
+      }
+    }
+
+    //directions of the data bins at the sampling points of SOFT, weighted by their area
+    level.data_directions.clear ();
+    level.data_weights.clear ();
+    for (int u = 0; u < width; u++)
+    {
+      double theta = (2 * u + 1) * M_PI / (4 * level.bandwidth);
+      for (int v = 0; v < width; v++)
+      {
+        if (level.data[u * width + v] <= 0.0)
+          continue;
+        double phi = v * M_PI / level.bandwidth;
+        level.data_directions.push_back (Eigen::Vector3d (sin (theta) * cos (phi),
+                                                          sin (theta) * sin (phi),
+                                                          cos (theta)));
+        level.data_weights.push_back (level.data[u * width + v] * sin (theta));
+      }
+    }
+  }
+}
+
+double
+FFTWCorrelate::levelCorrelation (const PyramidLevel &level, const Eigen::Matrix3d &rotation) const
+{
+  const int width = 2 * level.bandwidth;
+  double correlation = 0.0;
+  for (size_t i = 0; i < level.data_directions.size (); i++)
+  {
+    Eigen::Vector3d direction = rotation * level.data_directions[i];
+    double theta = acos (std::max (-1.0, std::min (1.0, direction (2))));
+    double phi = atan2 (direction (1), direction (0));
+    if (phi < 0.0)
+      phi += 2 * M_PI;
+    //bilinear interpolation between the sampling points of the map
+    double u = theta * 2 * level.bandwidth / M_PI - 0.5;
+    double v = phi * level.bandwidth / M_PI;
+    int u0 = static_cast<int> (floor (u));
+    int v0 = static_cast<int> (floor (v));
+    double du = u - u0;
+    double dv = v - v0;
+    int u1 = std::min (u0 + 1, width - 1);
+    u0 = std::max (u0, 0);
+    v0 = v0 % width;
+    int v1 = (v0 + 1) % width;
+    double value = (1 - du) * ((1 - dv) * level.smoothed_map[u0 * width + v0] + dv * level.smoothed_map[u0 * width + v1])
+                 + du * ((1 - dv) * level.smoothed_map[u1 * width + v0] + dv * level.smoothed_map[u1 * width + v1]);
+    correlation += level.data_weights[i] * value;
+  }
+  return (correlation);
+}
+
+void
+FFTWCorrelate::refineOnLevel (const PyramidLevel &level,
+                              bool interpolate,
+                              Eigen::Matrix3d &rotation,
+                              double &value) const
+{
+  //pattern search over small rotations about the axes, from one bin of this level down to a quarter
+  const double bin = M_PI / level.bandwidth;
+  double step = bin;
+  value = levelCorrelation (level, rotation);
+  while (step >= bin / 4)
+  {
+    Eigen::Matrix3d best_rotation = rotation;
+    double best_value = value;
+    for (int axis = 0; axis < 3; axis++)
+    {
+      for (int sign = -1; sign <= 1; sign += 2)
+      {
+        Eigen::Matrix3d candidate = Eigen::AngleAxisd (sign * step, Eigen::Vector3d::Unit (axis)).toRotationMatrix () * rotation;
+        double candidate_value = levelCorrelation (level, candidate);
+        if (candidate_value > best_value)
+        {
+          best_value = candidate_value;
+          best_rotation = candidate;
+        }
+      }
+    }
+    if (best_value > value)
+    {
+      rotation = best_rotation;
+      value = best_value;
+    }
+    else
+      step /= 2;
+  }
+  if (!interpolate)
+    return;
+
+  //parabolic interpolation of the maximum along every axis, at the last step size
+  Eigen::Vector3d offset = Eigen::Vector3d::Zero ();
+  for (int axis = 0; axis < 3; axis++)
+  {
+    double minus = levelCorrelation (level, Eigen::AngleAxisd (-step, Eigen::Vector3d::Unit (axis)).toRotationMatrix () * rotation);
+    double plus = levelCorrelation (level, Eigen::AngleAxisd (step, Eigen::Vector3d::Unit (axis)).toRotationMatrix () * rotation);
+    double curvature = minus - 2 * value + plus;
+    if (curvature < 0.0)
+      offset (axis) = std::max (-step, std::min (step, step * (minus - plus) / (2 * curvature)));
+  }
+  if (offset.norm () > 0.0)
+  {
+    Eigen::Matrix3d candidate = Eigen::AngleAxisd (offset.norm (), offset.normalized ()).toRotationMatrix () * rotation;
+    double candidate_value = levelCorrelation (level, candidate);
+    if (candidate_value >= value)
+    {
+      rotation = candidate;
+      value = candidate_value;
+    }
+  }
+}
+
 void
 FFTWCorrelate::rotatePointcloud(pcl::PointCloud<pcl::PointXYZ>::Ptr input,
                  pcl::PointCloud<pcl::PointXYZ>::Ptr output,
                  float *rm)
 {
-  output->resize(input->size());
-  for (size_t i = 0; i < input->size(); i++)
-  {
-    output->points[i].x = rm[0] * input->points[i].x + rm[1] * input->points[i].y + rm[2] * input->points[i].z;
-    output->points[i].y = rm[3] * input->points[i].x + rm[4] * input->points[i].y + rm[5] * input->points[i].z;
-    output->points[i].z = rm[6] * input->points[i].x + rm[7] * input->points[i].y + rm[8] * input->points[i].z;
-  }
+  tams::transformPointcloud (*input, *output, Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor> > (rm));
 }
 
 void
@@ -111,7 +478,7 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
                              const bool write2file,
                              const bool visualization)
 {
-  memset (egi, 0.0, sizeof (float) * 4 * bwIn_ * bwIn_);
+  memset (egi, 0, sizeof (float) * 4 * bandwidth * bandwidth);
   if (organized == true)
   {
     egiFromNormal(cloud, egi, bandwidth, visualization);
@@ -141,27 +508,23 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
   float tan_theta_step = tan (pcd_resolution_theta * M_PI / 180);
   float pcd_resolution_phi = 0.25;
   float tan_phi_step = tan (pcd_resolution_phi * M_PI / 180);
-  float *pcd_theta = new float[cloud->size ()];
-  float *pcd_phi = new float[cloud->size ()];
-  for (size_t i = 0; i < cloud->size (); i++)
-  {
-    pcd_theta[i] = acos (-cloud_normals->points[i].normal_z);
-    pcd_phi[i] = atan2 (-cloud_normals->points[i].normal_y, -cloud_normals->points[i].normal_x);
-    if (pcd_phi[i] < 0.0)
-      pcd_phi[i] = pcd_phi[i] + 2 * M_PI;
-  }
-  float area = 0.0;
+  float area = 1.0;
   int u = 0, v = 0;
   for (size_t i = 0; i < cloud_normals->size (); i++)
   {
-    area = 1;
-    u = floor (pcd_theta[i] / egi_resolution_theta);
-    v = floor (pcd_phi[i] / egi_resolution_phi);
+    const pcl::Normal &normal = cloud_normals->points[i];
+    //points without a valid neighbourhood have no normal
+    if (!pcl_isfinite (normal.normal_z))
+      continue;
+    float theta = acos (std::max (-1.0f, std::min (1.0f, -normal.normal_z)));
+    float phi = atan2 (-normal.normal_y, -normal.normal_x);
+    if (phi < 0.0)
+      phi += 2 * M_PI;
+    u = std::min (static_cast<int> (floor (theta / egi_resolution_theta)), 2 * bandwidth - 1);
+    v = std::min (static_cast<int> (floor (phi / egi_resolution_phi)), 2 * bandwidth - 1);
     egi[u * 2 * bandwidth + v] += area;
   }
 
-  delete [] pcd_theta;
-  delete [] pcd_phi;
   PCL_INFO ("%f seconds elapsed for constructing EGI for the point cloud.\n", t.elapsed());
   if (write2file)
   {
@@ -183,11 +546,6 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
         max = egi[i];
       }
     }
-    float *gray = new float[4 * bandwidth * bandwidth];
-    for (size_t i = 0; i < 4 * bandwidth * bandwidth; i++)
-    {
-      gray[i] = egi[i] / max;
-    }
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr sphere (new pcl::PointCloud<pcl::PointXYZRGB>);
     sphere->resize (4 * bandwidth * bandwidth);
     uint8_t r = 0, g = 0, b = 0;
@@ -203,7 +561,7 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
         sphere->points[i * 2 * bandwidth + j].x = cos (tmp_phi) * sin (tmp_theta);
         sphere->points[i * 2 * bandwidth + j].y = sin (tmp_phi) * sin (tmp_theta);
         sphere->points[i * 2 * bandwidth + j].z = cos (tmp_theta);
-        heatmapRGB (gray[i * 2 * bandwidth + j], r, g, b);
+        heatmapRGB (egi[i * 2 * bandwidth + j] / max, r, g, b);
         rgb = ((uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b);
         sphere->points[i * 2 * bandwidth + j].rgb = *reinterpret_cast<float*> (&rgb);
       }
@@ -217,8 +575,6 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
       normals->points[i].z = -cloud_normals->points[i].normal_z;
     }
 
-    delete [] gray;
-
     int viewports[2] = {1, 2};
     pcl::visualization::PCLVisualizer viewer ("EGI and normals distribution");
     viewer.createViewPort (0.0, 0.0, 0.5, 1.0, viewports[0]);
@@ -238,224 +594,232 @@ FFTWCorrelate::constellationImage(const std::string segments_file,
                                   const int bandwidth,
                                   float *egi)
 {
-  memset (egi, 0.0, sizeof (float) * 4 * bwIn_ * bwIn_);
-  float egi_resolution_theta = M_PI / bandwidth / 2;
-  float egi_resolution_phi = M_PI / bandwidth;
   float tmp;
-  float area;
-  int point_num;
-  float theta, phi;
+  int point_num = 0;
   std::ifstream file_in;
   file_in.open(segments_file.c_str());
   file_in >> tmp >> tmp >> tmp >> point_num;
-  Eigen::Vector3f normal(Eigen::Vector3f::Zero());
-  for (size_t i = 0; i < point_num; i++)
+  if (!file_in || point_num < 0)
   {
-    file_in >> normal(0) >> normal(1) >> normal(2) >> tmp >> tmp >> area >> point_num >> tmp >> tmp >> tmp;
-    if (area > 0.0)
-    {
-      theta = acos (normal(2));
-      phi = atan2 (normal(1), normal(0));
-      if (phi < 0.0)
-        phi = phi + 2 * M_PI;
-      int u = floor (theta / egi_resolution_theta);
-      int v = floor (phi / egi_resolution_phi);
-      egi[u * 2 * bandwidth + v] += area;
-    }
+    PCL_ERROR ("Couldn't read the segments from %s, the constellation image is empty!\n", segments_file.c_str ());
+    memset (egi, 0, sizeof (float) * 4 * bandwidth * bandwidth);
+    return;
+  }
+  //the segments are appended as they are read, a wrong count in a truncated file can not size the vector
+  tams::PlanarSegment::StdVector segments;
+  tams::PlanarSegment segment;
+  for (int i = 0; i < point_num && file_in; i++)
+  {
+    file_in >> segment.normal(0) >> segment.normal(1) >> segment.normal(2) >> segment.bias >> segment.mse
+            >> segment.area >> segment.point_num >> segment.mass_center(0) >> segment.mass_center(1) >> segment.mass_center(2);
+    if (file_in)
+      segments.push_back (segment);
+  }
+  if (!file_in)
+  {
+    PCL_ERROR ("The segments file %s is truncated, the constellation image is empty!\n", segments_file.c_str ());
+    memset (egi, 0, sizeof (float) * 4 * bandwidth * bandwidth);
+    return;
   }
   file_in.close ();
+  constellationImage(segments, bandwidth, egi, false);
 }
 
-
 void
-FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
-                             float *egi,
-                             const int bandwidth,
-                             const bool visualization)
+FFTWCorrelate::constellationImage(const tams::PlanarSegment::StdVector &segments,
+                                  const int bandwidth,
+                                  float *egi,
+                                  bool soft_binning)
 {
-  using namespace Eigen;
-  memset (egi, 0.0, sizeof (float) * bwIn_ * bwIn_);
-
-  int height = cloud->height;
-  int width = cloud->width;
-
-  bool *valid = new bool [height * width];
-  memset (valid, false, height * width * sizeof (bool));
-  std::vector<Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > points;
-  points.resize(height * width, Vector3f::Zero());
-  std::vector<Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > normals;
-  normals.resize(height * width, Vector3f::Zero());
-  bool *has_normal = new bool [height * width];
-  memset (has_normal, false, height * width * sizeof (bool));
-  float *rho = new float [height * width];
-  memset (rho, 0.0, height * width * sizeof (float));
-  for (size_t i = 0; i < cloud->height * cloud->width; i++)
-  {
-    if (cloud->points[i].z < 0 &&
-        (cloud->points[i].x * cloud->points[i].x + cloud->points[i].y * cloud->points[i].y) < 0.64)
+  memset (egi, 0.0, sizeof (float) * 4 * bandwidth * bandwidth);
+  const int width = 2 * bandwidth;
+  const double egi_resolution_theta = M_PI / bandwidth / 2;
+  const double egi_resolution_phi = M_PI / bandwidth;
+  //the spread of a segment is cut at three sigma, and at most this many bins around its own
+  const int max_radius = 8;
+  for (size_t i = 0; i < segments.size (); i++)
+  {
+    const tams::PlanarSegment &segment = segments[i];
+    if (segment.area <= 0.0)
+      continue;
+    Eigen::Vector3d normal = segment.normal.normalized ();
+    double theta = acos (std::max (-1.0, std::min (1.0, normal(2))));
+    double phi = atan2 (normal(1), normal(0));
+    if (phi < 0.0)
+      phi = phi + 2 * M_PI;
+    int u = std::min (static_cast<int> (floor (theta / egi_resolution_theta)), width - 1);
+    int v = std::min (static_cast<int> (floor (phi / egi_resolution_phi)), width - 1);
+
+    //angular covariance of the normal in the directions of theta and phi
+    Eigen::Matrix2d angular_covariance = Eigen::Matrix2d::Zero ();
+    if (soft_binning)
     {
-      cloud->points[i].x = cloud->points[i].y = cloud->points[i].z = 0;
+      Eigen::Matrix<double, 3, 2> tangents;
+      tangents.col(0) << cos (theta) * cos (phi), cos (theta) * sin (phi), -sin (theta);
+      tangents.col(1) << -sin (phi), cos (phi), 0.0;
+      angular_covariance = tangents.transpose () * segment.Cnn * tangents;
     }
-    else if (cloud->points[i].x * cloud->points[i].x +
-             cloud->points[i].y * cloud->points[i].y +
-             cloud->points[i].z * cloud->points[i].z > 29 * 29)
+    double sigma_theta = sqrt (std::max (angular_covariance(0, 0), 0.0));
+    double sigma_phi = sqrt (std::max (angular_covariance(1, 1), 0.0));
+    if (angular_covariance.determinant () <= 0.0 ||
+        (sigma_theta < egi_resolution_theta / 4 && sigma_phi < egi_resolution_phi * sin (theta) / 4))
     {
-      cloud->points[i].x = cloud->points[i].y = cloud->points[i].z = 0;
+      egi[u * width + v] += segment.area;
+      continue;
     }
-  }
 
-  for (size_t i = 0; i < cloud->height * cloud->width; i++)
-  {
-    if (cloud->points[i].x != 0.0 || cloud->points[i].y != 0.0 || cloud->points[i].z != 0.0)
+    //Gaussian weights of the bins around, normalized to the area of the segment
+    Eigen::Matrix2d information = angular_covariance.inverse ();
+    int radius_u = std::min (max_radius, static_cast<int> (ceil (3 * sigma_theta / egi_resolution_theta)));
+    int radius_v = max_radius;
+    if (sin (theta) * egi_resolution_phi * max_radius > 3 * sigma_phi)
+      radius_v = static_cast<int> (ceil (3 * sigma_phi / (sin (theta) * egi_resolution_phi)));
+    double weight_sum = 0.0;
+    binning_weights_.clear ();
+    for (int du = -radius_u; du <= radius_u; du++)
     {
-      points[i](0) = cloud->points[i].x;
-      points[i](1) = cloud->points[i].y;
-      points[i](2) = cloud->points[i].z;
-      rho[i] = points[i].norm();
-      valid[i] = true;
+      int bin_u = u + du;
+      if (bin_u < 0 || bin_u >= width)
+        continue;
+      double delta_theta = (bin_u + 0.5) * egi_resolution_theta - theta;
+      double sin_theta = sin ((bin_u + 0.5) * egi_resolution_theta);
+      for (int dv = -radius_v; dv <= radius_v; dv++)
+      {
+        int bin_v = (v + dv + width) % width;
+        double delta_phi = (v + dv + 0.5) * egi_resolution_phi - phi;
+        Eigen::Vector2d delta (delta_theta, delta_phi * sin_theta);
+        double weight = exp (-0.5 * delta.dot (information * delta));
+        binning_weights_.push_back (std::make_pair (bin_u * width + bin_v, weight));
+        weight_sum += weight;
+      }
     }
-  }
-
-//  float *radius_dis = new float [height * width];
-//  memset (radius_dis, 0.0, height * width * sizeof(float));
-//  std::vector<float> dis(8, 0.0);
-//  for (int i = 1; i < height - 1; i++)
-//  {
-//    for (int j = 1; j < width - 1; j++)
-//    {
-//      int index = i * width + j;
-//      if (valid[index])
-//      {
-//        dis[0] = valid[index - width - 1] ? fabs(rho[index] - rho[index - width - 1]) : 0.0;
-//        dis[1] = valid[index - width] ? fabs(rho[index] - rho[index - width]) : 0.0;
-//        dis[2] = valid[index - width + 1] ? fabs(rho[index] - rho[index - width + 1]) : 0.0;
-//        dis[3] = valid[index -1] ? fabs(rho[index] - rho[index -1]) : 0.0;
-//        dis[4] = valid[index + 1] ? fabs(rho[index] - rho[index + 1]): 0.0;
-//        dis[5] = valid[index + width - 1] ? fabs(rho[index] - rho[index + width - 1]) : 0.0;
-//        dis[6] = valid[index + width] ? fabs(rho[index] - rho[index + width]) : 0.0;
-//        dis[7] = valid[index + width + 1] ? fabs(rho[index] - rho[index + width + 1]) : 0.0;
-//        radius_dis[index] = *std::min_element(dis.begin(), dis.end());
-//      }
-//    }
-//  }
-
-  int subwindow_length = 7;
-  Vector3f sum;
-  Vector3f normal;
-  Matrix3f scatter_matrix;
-  Vector3f mass_center;
-  EigenSolver<Matrix3f> eigensolver;
-  Vector3f eigenvalues = Vector3f::Zero();
-  Matrix3f eigenvectors = Matrix3f::Zero();
-
-  int valid_cnt = 0;
-  int row = 0, col = 0;
-  int grid_size = (2 * subwindow_length + 1) * (2 * subwindow_length + 1);
-  int *indices = new int [grid_size];
-  for (int i = subwindow_length; i < width - subwindow_length; i++)
-  {
-    for (int j = subwindow_length; j < height - subwindow_length; j++)
+    if (weight_sum <= 0.0)
     {
-       if (!valid[j * width + i])
-         continue;
-       memset(indices, 0, grid_size * sizeof (int));
-       sum = Vector3f::Zero();
-       scatter_matrix = Matrix3f::Zero();
-       valid_cnt = 0;
-       int col_start = i - subwindow_length;
-       int col_end = i + subwindow_length;
-       int row_start = j - subwindow_length;
-       int row_end   = j + subwindow_length;
-       int t = 0;
-       for (col = col_start; col <= col_end; col++)
-       {
-         for (row = row_start; row <= row_end; row++)
-         {
-           indices[t++] = row * width + col;
-         }
-       }
-       for (int k = 0; k < grid_size; k++)
-       {
-         if (valid[indices[k]])
-         {
-           valid_cnt++;
-         }
-       }
-       //if (valid_cnt > grid_size * 0.7)
-       {
-         for (int k = 0; k < grid_size; k++)
-         {
-           if (valid[indices[k]])
-             sum += points[indices[k]];
-         }
-         mass_center = sum / valid_cnt;
-         for (int k = 0; k < grid_size; k++)
-         {
-           if (valid[indices[k]] )
-             scatter_matrix += (points[indices[k]] - mass_center) * (points[indices[k]] - mass_center).transpose();
-         }
-         eigensolver.compute(scatter_matrix);
-         eigenvalues = eigensolver.eigenvalues().real();
-         eigenvectors = eigensolver.eigenvectors().real();
-         int min_eigenvalue_index;
-         float lambda[2];
-         float min_eigenvalue = eigenvalues.minCoeff(&min_eigenvalue_index);
-         normal = eigenvectors.col(min_eigenvalue_index);
-         if (normal.dot(mass_center) < 0)
-           normal = -normal;
-         has_normal[j * width + i] = true;
-         normals[j * width + i] = normal;
-       }
+      egi[u * width + v] += segment.area;
+      continue;
     }
+    for (size_t k = 0; k < binning_weights_.size (); k++)
+      egi[binning_weights_[k].first] += segment.area * binning_weights_[k].second / weight_sum;
   }
-  float *pcd_theta = new float [height * width];
-  float *pcd_phi = new float [height * width];
-  float *area = new float [height * width];
-  memset (area, 0.0, height * width * sizeof (float));
+}
 
-  for (size_t i = 0; i < height * width; i++)
-  {
-    if (has_normal[i] && valid[i + 1] && valid[i + width] && valid[i + width +1])
-    {
-      area[i] += fabs(normals[i].dot(
-          points[i].cross(points[i + width]) +
-          points[i + width].cross(points[i + width + 1]) +
-          points[i + width + 1].cross(points[i + 1]) +
-          points[i + 1].cross(points[i])));
-    }
-  }
 
-  for (size_t i = 0; i < height * width; i++)
+/** \brief Whether a point of an organized scan is measured and outside of the robot.
+  * Invalid points are zero; points below the scanner within 0.8 m (the robot) and further than 29 m are ignored.
+  */
+static inline bool
+validScanPoint (const pcl::PointXYZ &point)
+{
+  float xy2 = point.x * point.x + point.y * point.y;
+  if (point.x == 0.0 && point.y == 0.0 && point.z == 0.0)
+    return (false);
+  if (point.z < 0 && xy2 < 0.64)
+    return (false);
+  return (xy2 + point.z * point.z <= 29 * 29);
+}
+
+void
+FFTWCorrelate::egiFromOrganizedCloud (const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                                      float *egi,
+                                      const int bandwidth,
+                                      const int pixel_step)
+{
+  const int height = cloud.height;
+  const int width = cloud.width;
+  const int step = pixel_step > 0 ? pixel_step : 1;
+  const int bin_num = 4 * bandwidth * bandwidth;
+  const float theta_scale = 2 * bandwidth / M_PI;
+  const float phi_scale = bandwidth / M_PI;
+  //neighbours further apart than this ratio of the range are on the other side of a jump edge
+  const float max_edge_ratio2 = 0.1 * 0.1 * (2 * step) * (2 * step);
+
+  int thread_num = 1;
+#ifdef _OPENMP
+  thread_num = omp_get_max_threads ();
+#endif
+  if (static_cast<int> (egi_histograms_.size ()) < thread_num)
+    egi_histograms_.resize (thread_num);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads (thread_num)
+#endif
   {
-    if (has_normal[i])
+    int thread_id = 0;
+#ifdef _OPENMP
+    thread_id = omp_get_thread_num ();
+    //the runtime may start fewer threads than requested, only their histograms are filled and summed
+#pragma omp single
+    thread_num = omp_get_num_threads ();
+#endif
+    std::vector<float> &histogram = egi_histograms_[thread_id];
+    histogram.assign (bin_num, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule (static)
+#endif
+    for (int row = step; row < height - step; row++)
     {
-      pcd_theta[i] = acos (normals[i](2));
-      pcd_phi[i] = atan2 (normals[i](1), normals[i](0));
-      if (pcd_phi[i] < 0.0)
-        pcd_phi[i] = pcd_phi[i] + 2 * M_PI;
+      for (int col = step; col < width - step; col++)
+      {
+        const pcl::PointXYZ &center = cloud.points[row * width + col];
+        const pcl::PointXYZ &left = cloud.points[row * width + col - step];
+        const pcl::PointXYZ &right = cloud.points[row * width + col + step];
+        const pcl::PointXYZ &up = cloud.points[(row - step) * width + col];
+        const pcl::PointXYZ &down = cloud.points[(row + step) * width + col];
+        if (!validScanPoint (center) || !validScanPoint (left) || !validScanPoint (right) ||
+            !validScanPoint (up) || !validScanPoint (down))
+          continue;
+
+        //normal as cross product of the central differences, whose norm is four times the area of the pixels
+        float hx = right.x - left.x, hy = right.y - left.y, hz = right.z - left.z;
+        float vx = down.x - up.x, vy = down.y - up.y, vz = down.z - up.z;
+        float range2 = center.x * center.x + center.y * center.y + center.z * center.z;
+        if (hx * hx + hy * hy + hz * hz > max_edge_ratio2 * range2 ||
+            vx * vx + vy * vy + vz * vz > max_edge_ratio2 * range2)
+          continue;
+        float nx = hy * vz - hz * vy;
+        float ny = hz * vx - hx * vz;
+        float nz = hx * vy - hy * vx;
+        float norm = sqrt (nx * nx + ny * ny + nz * nz);
+        if (norm <= 0.0)
+          continue;
+        //orient the normal away from the scanner, as the normals of the planar segments
+        if (nx * center.x + ny * center.y + nz * center.z < 0)
+          norm = -norm;
+        nx /= norm;
+        ny /= norm;
+        nz /= norm;
+
+        float theta = acos (std::max (-1.0f, std::min (1.0f, nz)));
+        float phi = atan2 (ny, nx);
+        if (phi < 0.0)
+          phi += 2 * M_PI;
+        int u = std::min (static_cast<int> (theta * theta_scale), 2 * bandwidth - 1);
+        int v = std::min (static_cast<int> (phi * phi_scale), 2 * bandwidth - 1);
+        histogram[u * 2 * bandwidth + v] += fabs (norm) / (4 * step * step);
+      }
     }
   }
 
-  float egi_resolution_theta = M_PI / bandwidth / 2;
-  float egi_resolution_phi = M_PI / bandwidth;
-
-  int u = 0, v = 0;
-  for (size_t i = 0; i < height * width; i++)
+  memcpy (egi, &egi_histograms_[0][0], sizeof (float) * bin_num);
+  for (int t = 1; t < thread_num; t++)
   {
-    if (has_normal[i])
-    {
-      u = floor (pcd_theta[i] / egi_resolution_theta);
-      v = floor (pcd_phi[i] / egi_resolution_phi);
-      egi[u * 2 * bandwidth + v] += area[i];
-    }
+    const std::vector<float> &histogram = egi_histograms_[t];
+    for (int i = 0; i < bin_num; i++)
+      egi[i] += histogram[i];
   }
+}
 
-  delete [] indices;
-  delete [] valid;
-  delete [] has_normal;
-  delete [] pcd_theta;
-  delete [] pcd_phi;
-  delete [] area;
+void
+FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
+                             float *egi,
+                             const int bandwidth,
+                             const bool visualization)
+{
+  boost::timer t;
+  t.restart();
+  egiFromOrganizedCloud (*cloud, egi, bandwidth);
+  PCL_INFO ("%f seconds elapsed for constructing EGI for the organized point cloud.\n", t.elapsed());
 
   if (visualization)
   {
@@ -467,11 +831,6 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
         max = egi[i];
       }
     }
-    float *gray = new float[4 * bandwidth * bandwidth];
-    for (size_t i = 0; i < 4 * bandwidth * bandwidth; i++)
-    {
-      gray[i] = egi[i] / max;
-    }
     pcl::PointCloud<pcl::PointXYZRGB>::Ptr sphere (new pcl::PointCloud<pcl::PointXYZRGB>);
     sphere->resize (4 * bandwidth * bandwidth);
     uint8_t r = 0, g = 0, b = 0;
@@ -487,12 +846,11 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
         sphere->points[i * 2 * bandwidth + j].x = cos (tmp_phi) * sin (tmp_theta);
         sphere->points[i * 2 * bandwidth + j].y = sin (tmp_phi) * sin (tmp_theta);
         sphere->points[i * 2 * bandwidth + j].z = cos (tmp_theta);
-        heatmapRGB (gray[i * 2 * bandwidth + j], r, g, b);
+        heatmapRGB (egi[i * 2 * bandwidth + j] / max, r, g, b);
         rgb = ((uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b);
         sphere->points[i * 2 * bandwidth + j].rgb = *reinterpret_cast<float*> (&rgb);
       }
     }
-    delete [] gray;
     pcl::visualization::PCLVisualizer viewer ("EGI");
     viewer.setBackgroundColor (0.0, 0.0, 0.0);
     viewer.addPointCloud (sphere, "EGI");
@@ -507,13 +865,15 @@ FFTWCorrelate::egiFromNormal(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
 void
 FFTWCorrelate::egiMap (bool organized, bool write2file, bool visualization)
 {
-  egiFromNormal(cloud_map_, egi_map_, bwIn_, organized, write2file, visualization);
+  egiFromNormal(cloud_map_, egi_map_.data (), bwIn_, organized, write2file, visualization);
+  map_spectrum_valid_ = false;
 }
 
 void
 FFTWCorrelate::egiData (bool organized, bool write2file, bool visualization)
 {
-  egiFromNormal(cloud_data_, egi_data_, bwIn_, organized, write2file, visualization);
+  egiFromNormal(cloud_data_, egi_data_.data (), bwIn_, organized, write2file, visualization);
+  data_spectrum_valid_ = false;
 }
 
 void
@@ -554,81 +914,49 @@ FFTWCorrelate::visualize()
 void
 FFTWCorrelate::initialize ()
 {
-  egi_map_ = new float [bwIn_ * bwIn_ * 4];
-  egi_data_ = new float [bwIn_ * bwIn_ * 4];
-  /*rms_ = new float [359 * 89 * 359 * 9];
-  rms_ = (float *) malloc (sizeof(float) * 359 * 89 * 359 * 9);
-  if (rms_ == NULL)
-    std::cout << "bad malloc!\n";
-  float calpha;
-  float salpha;
-  float cbeta;
-  float sbeta;
-  float cgamma;
-  float sgamma;
-  float alpha;
-  float beta;
-  float gamma;
-  float radian_per_degree = M_PI / 180;
-  int index;
-  for (int i = 1; i < 360; i++)
-  {
-    for (int j = 1; j < 90; j++)
-    {
-      for (int k = 1; k < 360; k++)
-      {
-        alpha = i * radian_per_degree;
-        beta = j * radian_per_degree;
-        gamma = k * radian_per_degree;
-        float calpha = cos(alpha);
-        float salpha = sin(alpha);
-        float cbeta = cos(beta);
-        float sbeta = sin(beta);
-        float cgamma = cos(gamma);
-        float sgamma = sin(gamma);
-        index = i * 287559 + j * 3231 + k * 9;
-        rms_[index    ] =  calpha * cbeta * cgamma - salpha * sgamma;
-        rms_[index + 1] = -calpha * cbeta * sgamma - salpha * cgamma;
-        rms_[index + 2] =  calpha * sbeta;
-        rms_[index + 3] =  salpha * cbeta * cgamma + calpha * sgamma;
-        rms_[index + 4] = -salpha * cbeta * sgamma + calpha * cgamma;
-        rms_[index + 5] =  salpha * sbeta;
-        rms_[index + 6] = -sbeta  * cgamma;
-        rms_[index + 7] =  sbeta  * sgamma;
-        rms_[index + 8] =  cbeta;
-      }
-    }
-  }*/
-}
-
-void FFTWCorrelate::test()
-{
-  struct timeval tpstart,tpend;
-  float timeuse;
-  gettimeofday(&tpstart,NULL);
-  float in[3] = {0, 0.707, 0.707};
-  float output[3];
-  for (int j = 0; j < 1; j++)
-  {
-    for (int i = 0; i < 359 * 89 * 359 * 9; i+=9)
-    {
-      rms_[i + 6] = i + j;
-      rms_[i + 7] = i + 2 * j;
-      rms_[i + 8] = i + 3 * j;
-    }
-  }
-  gettimeofday(&tpend,NULL);
-  timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-  timeuse/=1000000;
-  printf("Used Time:%f\n",timeuse);
-  for (int i = 359 * 89 * 359 * 9 - 81; i < 359 * 89 * 359 * 9; i += 9)
+  egi_map_.resize (bwIn_ * bwIn_ * 4);
+  egi_data_.resize (bwIn_ * bwIn_ * 4);
+  memset (egi_map_.data (), 0, egi_map_.size () * sizeof (float));
+  memset (egi_data_.data (), 0, egi_data_.size () * sizeof (float));
+  softCorrelationContextDestroy (context_);
+  for (size_t i = 0; i < batch_contexts_.size (); i++)
+    softCorrelationContextDestroy (batch_contexts_[i]);
+  batch_contexts_.clear ();
+  softCorrelationContextDestroy (coarse_context_);
+  coarse_context_ = NULL;
+  if (coarse_bandwidth_ > 0)
   {
-    std::cout << rms_[i + 6] << "  " << rms_[i + 7] << " " << rms_[i + 8] << std::endl;
+    int bandwidth = coarse_bandwidth_;
+    while (bandwidth < bwIn_)
+      bandwidth *= 2;
+    if (bandwidth != bwIn_)
+      PCL_ERROR ("The coarse bandwidth %d is not the input bandwidth %d divided by a power of two!\n",
+                 coarse_bandwidth_, bwIn_);
+    else
+      coarse_context_ = softCorrelationContextCreate (coarse_bandwidth_,
+                                                      wisdom_file_.empty () ? NULL : wisdom_file_.c_str (),
+                                                      thread_num_);
   }
+  context_ = softCorrelationContextCreate (bwIn_, wisdom_file_.empty () ? NULL : wisdom_file_.c_str (), thread_num_);
+  if (context_ == NULL)
+    PCL_ERROR ("Couldn't create the correlation context for bandwidth %d!\n", bwIn_);
+  map_spectrum_.bandwidth = data_spectrum_.bandwidth = bwIn_;
+  map_spectrum_.real.assign (bwIn_ * bwIn_, 0.0);
+  map_spectrum_.imag.assign (bwIn_ * bwIn_, 0.0);
+  data_spectrum_.real.assign (bwIn_ * bwIn_, 0.0);
+  data_spectrum_.imag.assign (bwIn_ * bwIn_, 0.0);
+  map_spectrum_valid_ = data_spectrum_valid_ = false;
 }
 
 void
 FFTWCorrelate::rotationMatrixFromEulerAngles(float *rm, const float alpha, const float beta, const float gamma)
+{
+  Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor> > rotation (rm);
+  rotation = rotationFromEulerAngles (alpha, beta, gamma);
+}
+
+Eigen::Matrix3f
+FFTWCorrelate::rotationFromEulerAngles(const float alpha, const float beta, const float gamma)
 {
   float calpha = cos(alpha);
   float salpha = sin(alpha);
@@ -636,20 +964,48 @@ FFTWCorrelate::rotationMatrixFromEulerAngles(float *rm, const float alpha, const
   float sbeta = sin(beta);
   float cgamma = cos(gamma);
   float sgamma = sin(gamma);
-  rm[0] = calpha * cbeta * cgamma - salpha * sgamma;
-  rm[1] = -calpha * cbeta * sgamma - salpha * cgamma;
-  rm[2] = calpha * sbeta;
-  rm[3] = salpha * cbeta * cgamma + calpha * sgamma;
-  rm[4] = -salpha * cbeta * sgamma + calpha * cgamma;
-  rm[5] = salpha * sbeta;
-  rm[6] = -sbeta * cgamma;
-  rm[7] = sbeta * sgamma;
-  rm[8] = cbeta;
+  Eigen::Matrix3f rotation;
+  rotation << calpha * cbeta * cgamma - salpha * sgamma, -calpha * cbeta * sgamma - salpha * cgamma, calpha * sbeta,
+              salpha * cbeta * cgamma + calpha * sgamma, -salpha * cbeta * sgamma + calpha * cgamma, salpha * sbeta,
+              -sbeta * cgamma, sbeta * sgamma, cbeta;
+  return (rotation);
+}
+
+void
+FFTWCorrelate::eulerAnglesFromRotation (const Eigen::Matrix3f &rotation, float &alpha, float &beta, float &gamma)
+{
+  const Eigen::Matrix3d r = rotation.cast<double> ();
+  beta = acos (std::max (-1.0, std::min (1.0, r (2, 2))));
+  if (sin (beta) > 1e-6)
+  {
+    alpha = atan2 (r (1, 2), r (0, 2));
+    gamma = atan2 (r (2, 1), -r (2, 0));
+  }
+  else
+  {
+    //only alpha - gamma (beta = 0) or alpha + gamma (beta = pi) is defined, gamma is set to 0
+    if (r (2, 2) > 0.0)
+      alpha = atan2 (r (1, 0), r (0, 0));
+    else
+      alpha = atan2 (-r (1, 0), -r (0, 0));
+    gamma = 0.0;
+  }
+  if (alpha < 0.0)
+    alpha += 2 * M_PI;
+  if (gamma < 0.0)
+    gamma += 2 * M_PI;
 }
 
 void
 FFTWCorrelate::dataAsMap ()
 {
   *cloud_map_ = *cloud_data_;
-  memcpy (egi_map_, egi_data_, bwIn_ * bwIn_ * 4 * sizeof (float));
+  memcpy (egi_map_.data (), egi_data_.data (), egi_data_.size () * sizeof (float));
+  if (data_spectrum_valid_)
+  {
+    map_spectrum_.real.swap (data_spectrum_.real);
+    map_spectrum_.imag.swap (data_spectrum_.imag);
+  }
+  map_spectrum_valid_ = data_spectrum_valid_;
+  data_spectrum_valid_ = false;
 }
@@ -38,7 +38,11 @@
  */
 
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "fftw_correlate/softFFTWCorrelateReal.h"
 #include "fftw3.h"
@@ -53,147 +57,124 @@
 
 #define NORM( x ) ( (x[0])*(x[0]) + (x[1])*(x[1]) )
 
+#ifdef SOFT_FFTW_THREADS
+/* fftw_init_threads has to be called once, before the first threaded plan */
+static int threads_initialized = 0 ;
+#endif
+
 /****************************************
 
- softFFTWCor2: simple wrapper for correlating two functions defined on the sphere;
-              if efficiency is important to you, or want more control,
-              e.g. want to correlate lots and lots of times without having
-	      reallocate tmp workspace, or change the bandwidth
-	      you want to correlate at, or correlate complex-valued
-              functions, you should look at
+ softCorrelationContextCreate: allocate the workspaces, the seminaive
+              Legendre tables and the quadrature weights, and create the
+              FFTW plans for correlating at bandwidth bw. All of them only
+              depend on the bandwidth, so one context serves any number of
+              correlations.
 
-	      test_soft_fftw_correlate2.c
-
-	      as an example of how to do it. softFFTWCor2() is basically
-	      test_soft_fftw_correlate2.c turned into a wrapper, with
-	      some simplifying assumptions.
-	      
   bw: bandwidth of signal and pattern
 
-  isReal: int defining whether or not the signal and pattern are
-          strictly real, or interleaved (complex)
-          = 1 -> strictly real
-          = 0 -> complex/interleaved
-
-  sig: double ptr to SIGNAL function samples;
-       for bandwidth bw, then, is a pointer to a
-       double array of size (2*bw)^3 + (isReal*(2*bw)^3)
-
-  pat: double ptr to PATTERN function samples
-       for bandwidth bw, then, is a pointer to a
-       double array of size (2*bw)^3 + (isReal*(2*bw)^3)
-
-  alpha, beta, gamma: ptrs to doubles; at the end of the routine,
-               will "contain" the angles alpha, beta, and gamma needed
-	       in order to rotate the SIGNAL to match the PATTERN; the
-	       order of rotation is:
+  wisdom_file: name of a file with FFTW wisdom, or NULL. If given, the
+               wisdom is imported before planning, the plans are measured
+               instead of estimated, and the wisdom is written back, so
+               only the first process pays for the planning.
 
-                   1) rotate by gamma about the z-axis
-                   2) rotate by beta about the y-axis
-                   3) rotate by alpha about the z-axis.
-		   
-	       where
-             
-	           0 <= alpha, gamma < 2*pi
-	           0 <= beta <= pi
+  nthreads: number of threads for the many-DFT stage of the inverse SO(3)
+            transform and for the search of its maximum. The DFT only
+            uses them if the library is built with SOFT_FFTW_THREADS,
+            i.e. linked with fftw3_threads, the search with OpenMP.
 
+  returns NULL if the memory could not be allocated.
 
 ***********************************/
-void softFFTWCorrelate( int bw,
-                    float *sig,
-                    float *pat,
-                    float *alpha,
-                    float *beta,
-                    float *gamma,
-                   	int isReal)
+SoftCorrelationContext *softCorrelationContextCreate( int bw,
+                                                      const char *wisdom_file,
+                                                      int nthreads )
 {
-  int i ;
-  int n, bwIn, bwOut, degLim ;
-  fftw_complex *workspace1, *workspace2  ;
-  double *workspace3 ;
-  double *tmpR, *tmpI ;
-  double *sigCoefR, *sigCoefI ;
-  double *patCoefR, *patCoefI ;
-  fftw_complex *so3Sig, *so3Coef ;
-  fftw_plan p1 ;
+  SoftCorrelationContext *ctx ;
+  int n, bwIn, bwOut ;
   int na[2], inembed[2], onembed[2] ;
   int rank, howmany, istride, idist, ostride, odist ;
-  int tmp, maxloc, ii, jj, kk ;
-  double tmpval, maxval ;
-  double *weights ;
-  double *seminaive_naive_tablespace  ;
-  double **seminaive_naive_table ;
-  fftw_plan dctPlan, fftPlan ;
   int howmany_rank ;
   fftw_iodim dims[1], howmany_dims[1];
-  
+  unsigned int rigor ;
+  FILE *fp ;
+
+  ctx = (SoftCorrelationContext *) calloc( 1, sizeof(SoftCorrelationContext) );
+  if ( ctx == NULL )
+    return NULL ;
+
   bwIn = bw ;
   bwOut = bw ;
-  degLim = bw - 1 ;
   n = 2 * bwIn ;
-
-  tmpR = (double *) malloc( sizeof(double) * ( n * n ) );
-  tmpI = (double *) malloc( sizeof(double) * ( n * n ) );
-  so3Sig = fftw_malloc( sizeof(fftw_complex) * (8*bwOut*bwOut*bwOut) );
-  workspace1 = fftw_malloc( sizeof(fftw_complex) * (8*bwOut*bwOut*bwOut) );
-  workspace2 = fftw_malloc( sizeof(fftw_complex) * ((14*bwIn*bwIn) + (48 * bwIn)));
-  workspace3 = (double *) malloc( sizeof(double) * (12*n + n*bwIn));
-  sigCoefR = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
-  sigCoefI = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
-  patCoefR = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
-  patCoefI = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
-  so3Coef = fftw_malloc( sizeof(fftw_complex) * ((4*bwOut*bwOut*bwOut-bwOut)/3) ) ;
-  seminaive_naive_tablespace =
+  ctx->bw = bw ;
+  ctx->nthreads = nthreads > 0 ? nthreads : 1 ;
+
+  ctx->tmpR = (double *) malloc( sizeof(double) * ( n * n ) );
+  ctx->tmpI = (double *) malloc( sizeof(double) * ( n * n ) );
+  ctx->so3Sig = fftw_malloc( sizeof(fftw_complex) * (8*bwOut*bwOut*bwOut) );
+  ctx->workspace1 = fftw_malloc( sizeof(fftw_complex) * (8*bwOut*bwOut*bwOut) );
+  ctx->workspace2 = fftw_malloc( sizeof(fftw_complex) * ((14*bwIn*bwIn) + (48 * bwIn)));
+  ctx->workspace3 = (double *) malloc( sizeof(double) * (12*n + n*bwIn));
+  ctx->sigCoefR = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
+  ctx->sigCoefI = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
+  ctx->patCoefR = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
+  ctx->patCoefI = (double *) malloc( sizeof(double) * bwIn * bwIn ) ;
+  ctx->so3Coef = fftw_malloc( sizeof(fftw_complex) * ((4*bwOut*bwOut*bwOut-bwOut)/3) ) ;
+  ctx->seminaive_naive_tablespace =
     (double *) malloc(sizeof(double) *
 		      (Reduced_Naive_TableSize(bwIn,bwIn) +
 		       Reduced_SpharmonicTableSize(bwIn,bwIn)));
-
-  weights = (double *) malloc(sizeof(double) * (4*bwIn));
-
-  /****
-       At this point, check to see if all the memory has been
-       allocated. If it has not, there's no point in going further.
-  ****/
-
-  if ( (seminaive_naive_tablespace == NULL) || (weights == NULL) ||
-       (tmpR == NULL) || (tmpI == NULL) ||
-       (so3Coef == NULL) ||
-       (workspace1 == NULL) || (workspace2 == NULL) ||
-       (workspace3 == NULL) ||
-       (sigCoefR == NULL) || (sigCoefI == NULL) ||
-       (patCoefR == NULL) || (patCoefI == NULL) ||
-	   (so3Sig == NULL) )
+  ctx->weights = (double *) malloc(sizeof(double) * (4*bwIn));
+
+  if ( (ctx->seminaive_naive_tablespace == NULL) || (ctx->weights == NULL) ||
+       (ctx->tmpR == NULL) || (ctx->tmpI == NULL) ||
+       (ctx->so3Coef == NULL) ||
+       (ctx->workspace1 == NULL) || (ctx->workspace2 == NULL) ||
+       (ctx->workspace3 == NULL) ||
+       (ctx->sigCoefR == NULL) || (ctx->sigCoefI == NULL) ||
+       (ctx->patCoefR == NULL) || (ctx->patCoefI == NULL) ||
+       (ctx->so3Sig == NULL) )
     {
       perror("Error in allocating memory");
-      exit( 1 ) ;
+      softCorrelationContextDestroy( ctx );
+      return NULL ;
     }
 
-  /* create fftw plans for the S^2 transforms */
-  /* first for the dct */
-  dctPlan = fftw_plan_r2r_1d( 2*bwIn, weights, workspace3,
-			      FFTW_REDFT10, FFTW_ESTIMATE ) ;
-
-  /* now for the fft */
-  /* 
-     IMPORTANT NOTE!!! READ THIS!!!
-
-     Now to make the fft plans.
+  /*
+    The plans are made before any array is filled, so measuring them may
+    overwrite the arrays. They are executed on other arrays of the
+    workspaces by the S^2 transforms, hence FFTW_UNALIGNED.
+  */
+  rigor = FFTW_ESTIMATE ;
+  if ( wisdom_file != NULL )
+    {
+      fp = fopen( wisdom_file, "r" );
+      if ( fp != NULL )
+	{
+	  fftw_import_wisdom_from_file( fp );
+	  fclose( fp );
+	}
+      rigor = FFTW_MEASURE | FFTW_UNALIGNED ;
+    }
 
-     Please note that the planning-rigor flag *must be* FFTW_ESTIMATE!
-     Why? Well, to try to keep things simple. I am using some of the
-     pointers to arrays in rotateFct's arguments in the fftw-planning
-     routines. If the planning-rigor is *not* FFTW_ESTIMATE, then
-     the arrays will be written over during the planning stage.
+#ifdef SOFT_FFTW_THREADS
+  if ( !threads_initialized )
+    {
+      fftw_init_threads( );
+      threads_initialized = 1 ;
+    }
+  /* the S^2 transforms are too small to gain from threads */
+  fftw_plan_with_nthreads( 1 ) ;
+#endif
 
-     Therefore, unless you are really really sure you know what
-     you're doing, keep the rigor as FFTW_ESTIMATE !!!
-  */
+  /* create fftw plans for the S^2 transforms */
+  /* first for the dct */
+  ctx->dctPlan = fftw_plan_r2r_1d( 2*bwIn, ctx->weights, ctx->workspace3,
+				   FFTW_REDFT10, rigor ) ;
 
   /*
     fftw "preamble" ;
     note  that this places in the transposed array
   */
-
   rank = 1 ;
   dims[0].n = 2*bwIn ;
   dims[0].is = 1 ;
@@ -203,14 +184,17 @@ void softFFTWCorrelate( int bw,
   howmany_dims[0].is = 2*bwIn ;
   howmany_dims[0].os = 1 ;
 
-  fftPlan = fftw_plan_guru_split_dft( rank, dims,
-				      howmany_rank, howmany_dims,
-				      tmpR, tmpI,
-				      (double *) workspace2,
-				      (double *) workspace2 + (n*n),
-				      FFTW_ESTIMATE );
+  ctx->fftPlan = fftw_plan_guru_split_dft( rank, dims,
+					   howmany_rank, howmany_dims,
+					   ctx->tmpR, ctx->tmpI,
+					   (double *) ctx->workspace2,
+					   (double *) ctx->workspace2 + (n*n),
+					   rigor );
 
   /* create plan for inverse SO(3) transform */
+#ifdef SOFT_FFTW_THREADS
+  fftw_plan_with_nthreads( ctx->nthreads ) ;
+#endif
   n = 2 * bwOut ;
   howmany = n*n ;
   idist = n ;
@@ -225,134 +209,496 @@ void softFFTWCorrelate( int bw,
   na[0] = 1 ;
   na[1] = n ;
 
-  p1 = fftw_plan_many_dft( rank, na, howmany,
-			   workspace1, inembed,
-			   istride, idist,
-			   so3Sig, onembed,
-			   ostride, odist,
-			   FFTW_FORWARD, FFTW_ESTIMATE );
+  ctx->p1 = fftw_plan_many_dft( rank, na, howmany,
+				ctx->workspace1, inembed,
+				istride, idist,
+				ctx->so3Sig, onembed,
+				ostride, odist,
+				FFTW_FORWARD, rigor );
+#ifdef SOFT_FFTW_THREADS
+  fftw_plan_with_nthreads( 1 ) ;
+#endif
+
+  if ( wisdom_file != NULL )
+    {
+      fp = fopen( wisdom_file, "w" );
+      if ( fp != NULL )
+	{
+	  fftw_export_wisdom_to_file( fp );
+	  fclose( fp );
+	}
+    }
 
+  /* the tables and weights are made after planning, which may have written over their arrays */
+  ctx->seminaive_naive_table = SemiNaive_Naive_Pml_Table(bwIn, bwIn,
+							 ctx->seminaive_naive_tablespace,
+							 (double *) ctx->workspace2);
 
-  seminaive_naive_table = SemiNaive_Naive_Pml_Table(bwIn, bwIn,
-						    seminaive_naive_tablespace,
-						    (double *) workspace2);
+  /* make quadrature weights for the S^2 transform */
+  makeweights( bwIn, ctx->weights ) ;
 
+  return ctx ;
+}
 
-  /* make quadrature weights for the S^2 transform */
-  makeweights( bwIn, weights ) ;
+/****************************************
 
-  n = 2 * bwIn ;
-  /* load SIGNAL samples into temp array */
+ softCorrelationContextDestroy: destroy the plans and free everything
+              of a context made by softCorrelationContextCreate.
+
+***********************************/
+void softCorrelationContextDestroy( SoftCorrelationContext *ctx )
+{
+  if ( ctx == NULL )
+    return ;
+
+  if ( ctx->p1 != NULL )
+    fftw_destroy_plan( ctx->p1 );
+  if ( ctx->fftPlan != NULL )
+    fftw_destroy_plan( ctx->fftPlan );
+  if ( ctx->dctPlan != NULL )
+    fftw_destroy_plan( ctx->dctPlan );
+
+  free( ctx->seminaive_naive_table ) ;
+  free( ctx->seminaive_naive_tablespace ) ;
+  free( ctx->weights );
+  fftw_free( ctx->so3Coef ) ;
+  free( ctx->patCoefI );
+  free( ctx->patCoefR );
+  free( ctx->sigCoefI );
+  free( ctx->sigCoefR );
+  free( ctx->workspace3 );
+  fftw_free( ctx->workspace2 );
+  fftw_free( ctx->workspace1 );
+  fftw_free( ctx->so3Sig ) ;
+  free( ctx->tmpI );
+  free( ctx->tmpR );
+  free( ctx );
+}
+
+/****************************************
+
+ softSphericalTransform: forward S^2 transform of the samples of one
+              function on the sphere, with the plans, tables and
+              workspaces of the given context.
+
+  samples: float ptr to (2*bw)^2 samples if isReal, otherwise
+           to (2*bw)^2 interleaved complex samples
+
+  coefR, coefI: double ptrs to arrays of size bw^2 which will contain
+           the real and imaginary parts of the spherical harmonic
+           coefficients; they can be kept and passed to
+           softFFTWCorrelateCoef as often as needed
+
+***********************************/
+void softSphericalTransform( SoftCorrelationContext *ctx,
+			     float *samples,
+			     double *coefR,
+			     double *coefI,
+			     int isReal)
+{
+  int i, n ;
+
+  n = 2 * ctx->bw ;
+
+  /* load samples into temp array; note that I'm
+     also providing 0s in the imaginary part */
   if ( isReal )
     for ( i = 0 ; i < n * n ; i ++ )
       {
-	tmpR[i] = sig[i];
-	tmpI[i] = 0. ;
+	ctx->tmpR[i] = samples[i];
+	ctx->tmpI[i] = 0. ;
       }
   else
     for ( i = 0 ; i < n * n ; i ++ )
       {
-	tmpR[i] = sig[2*i];
-	tmpI[i] = sig[2*i+1] ;
+	ctx->tmpR[i] = samples[2*i];
+	ctx->tmpI[i] = samples[2*i+1] ;
       }
 
-  /* spherical transform of SIGNAL */
-  FST_semi_memo( tmpR, tmpI,
-		 sigCoefR, sigCoefI,
-		 bwIn, seminaive_naive_table,
-		 (double *) workspace2, isReal, bwIn,
-		 &dctPlan, &fftPlan,
-		 weights );
-
-  /* load PATTERN samples into temp array; note that I'm
-     also providing 0s in the imaginary part */
-  if ( isReal )
-    for (i = 0 ; i < n * n ; i ++ )
-      {
-	tmpR[i] = pat[i] ;
-	tmpI[i] = 0.  ;
-      }
-  else
-    for (i = 0 ; i < n * n ; i ++ )
-      {
-	tmpR[i] = pat[2*i] ;
-	tmpI[i] = pat[2*i+1] ;
-      }
+  FST_semi_memo( ctx->tmpR, ctx->tmpI,
+		 coefR, coefI,
+		 ctx->bw, ctx->seminaive_naive_table,
+		 (double *) ctx->workspace2, isReal, ctx->bw,
+		 &ctx->dctPlan, &ctx->fftPlan,
+		 ctx->weights );
+}
 
-  /* spherical transform of PATTERN */
-  FST_semi_memo( tmpR, tmpI,
-		 patCoefR, patCoefI,
-		 bwIn, seminaive_naive_table,
-		 (double *) workspace2, isReal, bwIn,
-		 &dctPlan, &fftPlan,
-		 weights ) ;
+/****************************************
 
-  /* all done with the spherical transform, so free up
-     some memory before continuing */
-  free( seminaive_naive_table ) ;
-  free( seminaive_naive_tablespace ) ;
+ inverseCorrelation: combine the coefficients of SIGNAL and PATTERN
+              and do the inverse SO(3) transform into ctx->so3Sig.
 
+***********************************/
+static void inverseCorrelation( SoftCorrelationContext *ctx,
+				const double *sigCoefR,
+				const double *sigCoefI,
+				const double *patCoefR,
+				const double *patCoefI,
+				int isReal)
+{
+  int bwIn, bwOut, degLim ;
+
+  bwIn = ctx->bw ;
+  bwOut = ctx->bw ;
+  degLim = ctx->bw - 1 ;
 
   /* combine coefficients */
   so3CombineCoef_fftw( bwIn, bwOut, degLim,
-		       sigCoefR, sigCoefI,
-		       patCoefR, patCoefI,
-		       so3Coef ) ;
+		       (double *) sigCoefR, (double *) sigCoefI,
+		       (double *) patCoefR, (double *) patCoefI,
+		       ctx->so3Coef ) ;
 
   /* now inverse so(3) */
   Inverse_SO3_Naive_fftw( bwOut,
-			  so3Coef,
-			  so3Sig,
-			  workspace1,
-			  workspace2,
-			  workspace3,
-			  &p1,
+			  ctx->so3Coef,
+			  ctx->so3Sig,
+			  ctx->workspace1,
+			  ctx->workspace2,
+			  ctx->workspace3,
+			  &ctx->p1,
 			  isReal ) ;
+}
+
+/****************************************
+
+ gridAngles: Euler angles of location loc of the SO(3) grid at
+              bandwidth bwOut.
 
-  /* now find max value */
+***********************************/
+static void gridAngles( int bwOut,
+			int loc,
+			float *alpha,
+			float *beta,
+			float *gamma )
+{
+  int tmp, ii, jj, kk ;
+
+  ii = floor( loc / (4.*bwOut*bwOut) );
+  tmp = loc - (ii*4.*bwOut*bwOut);
+  jj = floor( tmp / (2.*bwOut) );
+  tmp = loc - (ii *4*bwOut*bwOut) - jj*(2*bwOut);
+  kk = tmp ;
+
+  *alpha = M_PI*jj/((double) bwOut) ;
+  *beta =  M_PI*(2*ii+1)/(4.*bwOut) ;
+  *gamma = M_PI*kk/((double) bwOut) ;
+}
+
+/****************************************
+
+ softFFTWCorrelateCoef: correlate SIGNAL and PATTERN given by their
+              spherical harmonic coefficients (see softSphericalTransform),
+              i.e. combine them, do the inverse SO(3) transform and find
+              its maximum. The angles are those of softFFTWCorrelate.
+              Contexts are independent, so correlations with different
+              contexts may run in parallel.
+
+  returns the squared magnitude of the correlation at its maximum.
+
+***********************************/
+double softFFTWCorrelateCoef( SoftCorrelationContext *ctx,
+			      const double *sigCoefR,
+			      const double *sigCoefI,
+			      const double *patCoefR,
+			      const double *patCoefI,
+			      float *alpha,
+			      float *beta,
+			      float *gamma,
+			      int isReal)
+{
+  int i ;
+  int bwOut ;
+  int maxloc ;
+  double tmpval, maxval ;
+
+  bwOut = ctx->bw ;
+
+  inverseCorrelation( ctx, sigCoefR, sigCoefI, patCoefR, patCoefI, isReal );
+
+  /* now find max value; every thread searches a block of the grid
+     and ties go to the first location, as in the serial search */
   maxval = 0.0 ;
   maxloc = 0 ;
-  for ( i = 0 ; i < 8*bwOut*bwOut*bwOut; i ++ )
+#ifdef _OPENMP
+#pragma omp parallel num_threads( ctx->nthreads ) private( i, tmpval )
+#endif
+  {
+    double localval = 0.0 ;
+    int localloc = 0 ;
+#ifdef _OPENMP
+#pragma omp for schedule( static )
+#endif
+    for ( i = 0 ; i < 8*bwOut*bwOut*bwOut; i ++ )
+      {
+	tmpval = NORM( ctx->so3Sig[i] );
+	if ( tmpval > localval )
+	  {
+	    localval = tmpval;
+	    localloc = i ;
+	  }
+      }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
     {
-      tmpval = NORM( so3Sig[i] );
-      if ( tmpval > maxval )
+      if ( (localval > maxval) ||
+	   ((localval == maxval) && (localval > 0.0) && (localloc < maxloc)) )
 	{
-	  maxval = tmpval;
-	  maxloc = i ;
+	  maxval = localval ;
+	  maxloc = localloc ;
 	}
     }
+  }
 
+  gridAngles( bwOut, maxloc, alpha, beta, gamma );
 
-  ii = floor( maxloc / (4.*bwOut*bwOut) );
-  tmp = maxloc - (ii*4.*bwOut*bwOut);
-  jj = floor( tmp / (2.*bwOut) );
-  tmp = maxloc - (ii *4*bwOut*bwOut) - jj*(2*bwOut);
-  kk = tmp ;
+  return maxval ;
+}
 
+/****************************************
 
+ softFFTWCorrelatePeaks: correlate SIGNAL and PATTERN given by their
+              spherical harmonic coefficients like softFFTWCorrelateCoef,
+              but find the maxPeaks largest local maxima of the correlation
+              instead of its global maximum, in one pass over the grid.
+              A local maximum is at least as large as its 26 neighbours on
+              the SO(3) grid, which wraps around in alpha and gamma; of
+              equal neighbours only the first location counts.
 
-  *alpha = M_PI*jj/((double) bwOut) ;
-  *beta =  M_PI*(2*ii+1)/(4.*bwOut) ;
-  *gamma = M_PI*kk/((double) bwOut) ;
+  alpha, beta, gamma, values: arrays of size maxPeaks, which will contain
+              the angles and the squared magnitudes of the maxima,
+              largest first
+
+  psr: array of size maxPeaks for the peak-to-sidelobe ratios of the
+       maxima, or NULL. The ratio is (peak - mean) / deviation of the
+       magnitudes of the correlation outside of the 5x5x5 cells around
+       the peak, so a ratio close to the one of the next maximum means
+       an ambiguous rotation.
+
+  returns the number of maxima found, at most maxPeaks.
+
+***********************************/
+int softFFTWCorrelatePeaks( SoftCorrelationContext *ctx,
+			    const double *sigCoefR,
+			    const double *sigCoefI,
+			    const double *patCoefR,
+			    const double *patCoefI,
+			    int maxPeaks,
+			    float *alpha,
+			    float *beta,
+			    float *gamma,
+			    double *values,
+			    double *psr,
+			    int isReal)
+{
+  int i, j, n, peakNum ;
+  int ii, jj, kk, di, dj, dk, ni, nj, nk, nloc ;
+  int isPeak, windowNum ;
+  int *locs ;
+  double tmpval, nval, magnitude ;
+  double sum, sumSq, windowSum, windowSumSq, mean, variance ;
+
+  if ( maxPeaks <= 0 )
+    return 0 ;
+  locs = (int *) malloc( sizeof(int) * maxPeaks );
+  if ( locs == NULL )
+    {
+      perror("Error in allocating memory");
+      return 0 ;
+    }
+
+  inverseCorrelation( ctx, sigCoefR, sigCoefI, patCoefR, patCoefI, isReal );
 
-  /* clean up */
-
-  fftw_destroy_plan( p1 );
-  fftw_destroy_plan( fftPlan );
-  fftw_destroy_plan( dctPlan );
-
-  free( weights );
-  fftw_free( so3Coef ) ;
-  free( patCoefI );
-  free( patCoefR );
-  free( sigCoefI );
-  free( sigCoefR );
-  free( workspace3 );
-  fftw_free( workspace2 );
-  fftw_free( workspace1 );
-  fftw_free( so3Sig ) ;
-  free( tmpI );
-  free( tmpR );
+  n = 2 * ctx->bw ;
+  peakNum = 0 ;
+  sum = 0.0 ;
+  sumSq = 0.0 ;
+  for ( i = 0 ; i < n*n*n ; i ++ )
+    {
+      tmpval = NORM( ctx->so3Sig[i] );
+      if ( psr != NULL )
+	{
+	  sum += sqrt( tmpval ) ;
+	  sumSq += tmpval ;
+	}
+      /* most locations are below the smallest peak kept so far */
+      if ( (tmpval <= 0.0) ||
+	   ((peakNum == maxPeaks) && (tmpval <= values[peakNum-1])) )
+	continue ;
+
+      ii = i / (n*n) ;
+      jj = (i / n) % n ;
+      kk = i % n ;
+      isPeak = 1 ;
+      for ( di = -1 ; (di <= 1) && isPeak ; di ++ )
+	{
+	  ni = ii + di ;
+	  if ( (ni < 0) || (ni >= n) )
+	    continue ;
+	  for ( dj = -1 ; (dj <= 1) && isPeak ; dj ++ )
+	    {
+	      nj = (jj + dj + n) % n ;
+	      for ( dk = -1 ; (dk <= 1) && isPeak ; dk ++ )
+		{
+		  nk = (kk + dk + n) % n ;
+		  nloc = ni*n*n + nj*n + nk ;
+		  if ( nloc == i )
+		    continue ;
+		  nval = NORM( ctx->so3Sig[nloc] );
+		  if ( (nval > tmpval) || ((nval == tmpval) && (nloc < i)) )
+		    isPeak = 0 ;
+		}
+	    }
+	}
+      if ( !isPeak )
+	continue ;
+
+      /* insert it into the sorted list of peaks */
+      if ( peakNum < maxPeaks )
+	peakNum ++ ;
+      for ( j = peakNum - 1 ; (j > 0) && (values[j-1] < tmpval) ; j -- )
+	{
+	  values[j] = values[j-1] ;
+	  locs[j] = locs[j-1] ;
+	}
+      values[j] = tmpval ;
+      locs[j] = i ;
+    }
+
+  for ( j = 0 ; j < peakNum ; j ++ )
+    {
+      gridAngles( ctx->bw, locs[j], &alpha[j], &beta[j], &gamma[j] );
+      if ( psr == NULL )
+	continue ;
+
+      /* statistics of the sidelobe, i.e. the grid without the window around the peak */
+      ii = locs[j] / (n*n) ;
+      jj = (locs[j] / n) % n ;
+      kk = locs[j] % n ;
+      windowSum = 0.0 ;
+      windowSumSq = 0.0 ;
+      windowNum = 0 ;
+      for ( di = -2 ; di <= 2 ; di ++ )
+	{
+	  ni = ii + di ;
+	  if ( (ni < 0) || (ni >= n) )
+	    continue ;
+	  for ( dj = -2 ; dj <= 2 ; dj ++ )
+	    {
+	      nj = (jj + dj + n) % n ;
+	      for ( dk = -2 ; dk <= 2 ; dk ++ )
+		{
+		  nk = (kk + dk + n) % n ;
+		  nval = NORM( ctx->so3Sig[ni*n*n + nj*n + nk] );
+		  windowSum += sqrt( nval ) ;
+		  windowSumSq += nval ;
+		  windowNum ++ ;
+		}
+	    }
+	}
+      mean = (sum - windowSum) / (n*n*n - windowNum) ;
+      variance = (sumSq - windowSumSq) / (n*n*n - windowNum) - mean * mean ;
+      magnitude = sqrt( values[j] ) ;
+      psr[j] = variance > 0.0 ? (magnitude - mean) / sqrt( variance ) : 0.0 ;
+    }
+
+  free( locs );
+  return peakNum ;
+}
+
+/****************************************
+
+ softFFTWCorrelateContext: correlate SIGNAL and PATTERN with the plans,
+              tables and workspaces of the given context, see
+              softFFTWCorrelate for the arguments. The bandwidth is the
+              one of the context. Both functions are transformed, use
+              softSphericalTransform and softFFTWCorrelateCoef to
+              transform a function only once.
+
+***********************************/
+void softFFTWCorrelateContext( SoftCorrelationContext *ctx,
+			       float *sig,
+			       float *pat,
+			       float *alpha,
+			       float *beta,
+			       float *gamma,
+			       int isReal)
+{
+  /* spherical transform of SIGNAL */
+  softSphericalTransform( ctx, sig, ctx->sigCoefR, ctx->sigCoefI, isReal );
+
+  /* spherical transform of PATTERN */
+  softSphericalTransform( ctx, pat, ctx->patCoefR, ctx->patCoefI, isReal );
 
+  softFFTWCorrelateCoef( ctx,
+			 ctx->sigCoefR, ctx->sigCoefI,
+			 ctx->patCoefR, ctx->patCoefI,
+			 alpha, beta, gamma, isReal );
 }
 
+/****************************************
+
+ softFFTWCor2: simple wrapper for correlating two functions defined on the sphere;
+              if efficiency is important to you, or want more control,
+              e.g. want to correlate lots and lots of times without having
+	      reallocate tmp workspace, or change the bandwidth
+	      you want to correlate at, or correlate complex-valued
+              functions, you should look at
+
+	      test_soft_fftw_correlate2.c
+
+	      as an example of how to do it. softFFTWCor2() is basically
+	      test_soft_fftw_correlate2.c turned into a wrapper, with
+	      some simplifying assumptions.
+	      
+  bw: bandwidth of signal and pattern
+
+  isReal: int defining whether or not the signal and pattern are
+          strictly real, or interleaved (complex)
+          = 1 -> strictly real
+          = 0 -> complex/interleaved
+
+  sig: double ptr to SIGNAL function samples;
+       for bandwidth bw, then, is a pointer to a
+       double array of size (2*bw)^3 + (isReal*(2*bw)^3)
+
+  pat: double ptr to PATTERN function samples
+       for bandwidth bw, then, is a pointer to a
+       double array of size (2*bw)^3 + (isReal*(2*bw)^3)
+
+  alpha, beta, gamma: ptrs to doubles; at the end of the routine,
+               will "contain" the angles alpha, beta, and gamma needed
+	       in order to rotate the SIGNAL to match the PATTERN; the
+	       order of rotation is:
+
+                   1) rotate by gamma about the z-axis
+                   2) rotate by beta about the y-axis
+                   3) rotate by alpha about the z-axis.
+		   
+	       where
+             
+	           0 <= alpha, gamma < 2*pi
+	           0 <= beta <= pi
+
+
+  A context is made for the bandwidth, used once and destroyed; for
+  repeated correlations at the same bandwidth use a context from
+  softCorrelationContextCreate with softFFTWCorrelateContext.
+
+***********************************/
+void softFFTWCorrelate( int bw,
+                    float *sig,
+                    float *pat,
+                    float *alpha,
+                    float *beta,
+                    float *gamma,
+                   	int isReal)
+{
+  SoftCorrelationContext *ctx ;
+
+  ctx = softCorrelationContextCreate( bw, NULL, 1 );
+  if ( ctx == NULL )
+    exit( 1 ) ;
+  softFFTWCorrelateContext( ctx, sig, pat, alpha, beta, gamma, isReal );
+  softCorrelationContextDestroy( ctx );
+}
@@ -0,0 +1,73 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+#include <stdio.h>
+#include "fftw_correlate/fftw_correlate.h"
+
+/** Round trip of FFTWCorrelate::eulerAnglesFromRotation through FFTWCorrelate::rotationFromEulerAngles,
+    including the singular cases beta = 0 and beta = pi, where only alpha - gamma or alpha + gamma is defined. */
+int
+main ()
+{
+  int failures = 0;
+  const float betas[3] = {0.0f, static_cast<float> (M_PI / 2), static_cast<float> (M_PI)};
+  const float angles[4] = {0.0f, 0.7f, 0.2f, 5.5f};
+  for (int b = 0; b < 3; b++)
+  {
+    for (int a = 0; a < 4; a++)
+    {
+      for (int g = 0; g < 4; g++)
+      {
+        Eigen::Matrix3f rotation = FFTWCorrelate::rotationFromEulerAngles (angles[a], betas[b], angles[g]);
+        float alpha, beta, gamma;
+        FFTWCorrelate::eulerAnglesFromRotation (rotation, alpha, beta, gamma);
+        float error = (FFTWCorrelate::rotationFromEulerAngles (alpha, beta, gamma) - rotation).cwiseAbs ().maxCoeff ();
+        if (error > 1e-4)
+        {
+          printf ("alpha %f, beta %f, gamma %f: the rebuilt rotation differs by %f\n",
+                  angles[a], betas[b], angles[g], error);
+          failures++;
+        }
+      }
+    }
+  }
+  if (failures == 0)
+    printf ("Euler angles test passed\n");
+  return (failures == 0 ? 0 : 1);
+}
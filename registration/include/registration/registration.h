@@ -107,8 +107,263 @@ namespace tams
         return (x.first == y.first && x.second == y.second && x.third == y.third);
       }
 
+      friend bool
+      operator< (const AreaConsistentPairTriplets &x, const AreaConsistentPairTriplets &y)
+      {
+        if (x.first != y.first)
+          return (x.first < y.first);
+        if (x.second != y.second)
+          return (x.second < y.second);
+        return (x.third < y.third);
+      }
+
       friend std::size_t hash_value(const AreaConsistentPairTriplets &x)
-      {  return std::size_t(x.first * 100 + x.second * 10 + x.third); }
+      {
+        std::size_t seed = 0;
+        boost::hash_combine (seed, x.first);
+        boost::hash_combine (seed, x.second);
+        boost::hash_combine (seed, x.third);
+        return seed;
+      }
+  };
+
+  /** \brief A third area-consistent pair for a first and second pair, as found by the triplet search.
+    * It passed all tests except the rotation test of the correspondences accumulated so far, which is done in serial order.
+    * key holds the sorted pair indices, second the index of the second pair, pairs the correspondences in the order they were picked.
+    */
+  struct PairTripletHypothesis
+  {
+    AreaConsistentPairTriplets key;
+    int second;
+    AreaConsistentPair pairs[3];
+    Matrix3d rotation;
+    Vector3d translation;
+  };
+
+  /** \brief Candidate buffers of the triplet search, one per thread, reused from one registration to the next. */
+  struct TripletSearchBuffers
+  {
+    std::vector<int> data_candidates;
+    std::vector<int> second_pairs;
+    std::vector<int> third_pairs;
+  };
+
+  /** \brief Scratch buffers of the unique mapping, reused from one solution to the next.
+    * The counts are indexed by segment and are all zero between two calls.
+    */
+  struct AssignmentBuffers
+  {
+    std::vector<int> lhs_count;
+    std::vector<int> rhs_count;
+    std::vector<int> rows;
+    std::vector<int> cols;
+    std::vector<int> edges;
+    std::vector<double> costs;
+    std::vector<char> keep;
+    std::vector<int> row_to_col;
+    std::vector<std::pair<double, int> > order;
+    /** state of the Hungarian method. */
+    std::vector<double> u;
+    std::vector<double> v;
+    std::vector<double> min_slack;
+    std::vector<int> col_to_row;
+    std::vector<int> way;
+    std::vector<char> used;
+  };
+
+  /** \brief Pairwise relations between the big segments of one scan, stored row-major in flat arrays.
+    * Entry (i,j) holds the cosine and the angle between the normals of segment i and j, and whether the
+    * two segments are far enough from parallel and anti-parallel to be used together in a hypothesis.
+    */
+  struct SegmentPairTable
+  {
+    SegmentPairTable (): size (0) {}
+
+    /** \brief Fill the table for the given segments.
+      * \param[in] segments the big segments of one scan
+      * \param[in] cos_min_angle cosine of the minimum angle between non-parallel segments
+      * \param[in] cos_max_angle cosine of the maximum angle between non-parallel segments
+      */
+    void
+    compute (const PlanarSegment::StdVector &segments, double cos_min_angle, double cos_max_angle);
+
+    void
+    swap (SegmentPairTable &other)
+    {
+      std::swap (size, other.size);
+      cos_angle.swap (other.cos_angle);
+      angle.swap (other.angle);
+      non_parallel.swap (other.non_parallel);
+    }
+
+    inline int
+    index (int i, int j) const
+    {
+      return (i * size + j);
+    }
+
+    int size;
+    std::vector<double> cos_angle;
+    std::vector<double> angle;
+    std::vector<char> non_parallel;
+  };
+
+  /** \brief Candidate index on the rotation-invariant angle signature of segment pairs in one scan.
+    * Row i lists the segments which are non-parallel to segment i, sorted by the angle between their normals
+    * and the normal of segment i, so the segments whose angle to i lies in a given range are found by binary search.
+    */
+  struct AngleSignatureIndex
+  {
+    AngleSignatureIndex (): size (0) {}
+
+    /** \brief Build the index from the segment pair table of the same scan. */
+    void
+    compute (const SegmentPairTable &relations);
+
+    /** \brief Append the segments j with min_angle <= angle(i,j) <= max_angle to segments, in the order of the angle.
+      * \param[in] i the reference segment
+      * \param[in] min_angle lower bound of the angle in radians
+      * \param[in] max_angle upper bound of the angle in radians
+      * \param[out] segments the indices of the found segments are appended
+      */
+    void
+    rangeQuery (int i, double min_angle, double max_angle, std::vector<int> &segments) const;
+
+    int size;
+    std::vector<int> offsets;
+    std::vector<double> angles;
+    std::vector<int> segments;
+    /** the row being sorted by compute (), kept to avoid reallocation. */
+    std::vector<std::pair<double, int> > row;
+  };
+
+  /** \brief Set of pair triplets with open addressing in a flat table.
+    * reset () empties it and keeps the memory of the table for the next registration.
+    */
+  class PairTripletSet
+  {
+    public:
+      /** \brief Empty the set, which can then hold up to max_size triplets. */
+      void
+      reset (size_t max_size)
+      {
+        size_t capacity = 16;
+        while (capacity < 2 * max_size)
+          capacity *= 2;
+        table_.assign (capacity, AreaConsistentPairTriplets ());
+      }
+
+      /** \brief Insert the given triplet, return false if it was in the set already. */
+      bool
+      insert (const AreaConsistentPairTriplets &key)
+      {
+        size_t mask = table_.size () - 1;
+        for (size_t i = hash_value (key) & mask; ; i = (i + 1) & mask)
+        {
+          if (table_[i].first < 0)
+          {
+            table_[i] = key;
+            return (true);
+          }
+          if (table_[i] == key)
+            return (false);
+        }
+      }
+
+    private:
+      std::vector<AreaConsistentPairTriplets> table_;
+  };
+
+  /** \brief The correspondences of a solution, a contiguous range of the pairs in a HypothesisPool. */
+  struct CorrespondenceRange
+  {
+    typedef AreaConsistentPair* iterator;
+    typedef const AreaConsistentPair* const_iterator;
+
+    CorrespondenceRange (): pool (NULL), offset (0), count (0) {}
+
+    iterator
+    begin () const
+    {
+      return (count > 0 ? &(*pool)[offset] : NULL);
+    }
+
+    iterator
+    end () const
+    {
+      return (begin () + count);
+    }
+
+    size_t
+    size () const
+    {
+      return (count);
+    }
+
+    bool
+    empty () const
+    {
+      return (count == 0);
+    }
+
+    AreaConsistentPair&
+    operator[] (size_t i) const
+    {
+      return ((*pool)[offset + i]);
+    }
+
+    AreaConsistentPair::StdVector *pool;
+    int offset;
+    int count;
+  };
+
+  /** \brief Arena for the correspondences of all the hypotheses of one registration.
+    * Every solution is a fixed-size record referring to a range of the pool. Ranges are only appended to or
+    * trimmed at the end of the pool, reset () empties it and keeps its memory for the next registration.
+    */
+  class HypothesisPool
+  {
+    public:
+      /** \brief Start an empty range at the end of the pool. */
+      CorrespondenceRange
+      open ()
+      {
+        CorrespondenceRange range;
+        range.pool = &pairs_;
+        range.offset = static_cast<int> (pairs_.size ());
+        return (range);
+      }
+
+      /** \brief Append a pair to the given range, which has to be the last one of the pool. */
+      void
+      append (CorrespondenceRange &range, const AreaConsistentPair &pair)
+      {
+        pairs_.push_back (pair);
+        range.count++;
+      }
+
+      /** \brief Drop everything behind the end of the given range. */
+      void
+      trim (const CorrespondenceRange &range)
+      {
+        pairs_.resize (range.offset + range.count);
+      }
+
+      /** \brief Drop the given range and everything behind it. */
+      void
+      release (const CorrespondenceRange &range)
+      {
+        pairs_.resize (range.offset);
+      }
+
+      void
+      reset ()
+      {
+        pairs_.clear ();
+      }
+
+    private:
+      AreaConsistentPair::StdVector pairs_;
   };
 
   struct Solution
@@ -116,7 +371,7 @@ namespace tams
     Vector3d translation;
     Matrix3d rotation;
     double total_area;
-    AreaConsistentPair::StdVector correspondences;
+    CorrespondenceRange correspondences;
   };
 
   struct RCPPPair
@@ -172,7 +427,13 @@ class Registration
     map_segments_ (new PlanarSegment::StdVector), data_segments_ (new PlanarSegment::StdVector),
     big_map_segments_(new PlanarSegment::StdVector), big_data_segments_(new PlanarSegment::StdVector),
     area_consistent_planes_(new AreaConsistentPair::StdVector), rotation_consistent_pairs_(new RCPPPair::StdVector),
-    rotation_ (Matrix3d::Zero()), translation_ (Vector3d::Zero())
+    map_relations_dirty_ (true), data_relations_dirty_ (true),
+    deadline_ (0.0), score_ (0.0), explored_fraction_ (0.0),
+    rotation_ (Matrix3d::Zero()), translation_ (Vector3d::Zero()),
+    has_pose_prior_ (false), prior_rotation_ (Matrix3d::Identity()), prior_translation_ (Vector3d::Zero()),
+    prior_rotation_covariance_ (Matrix3d::Zero()), prior_translation_covariance_ (Matrix3d::Zero()),
+    prior_rotation_information_ (Matrix3d::Zero()), prior_translation_information_ (Matrix3d::Zero()),
+    prior_rotation_sigma_ (0.0)
   {
   }
   /** \brief empty destruction*/
@@ -243,6 +504,31 @@ class Registration
   void
   setDataSegments(std::string segments_file);
 
+  /** \brief Use the current data cloud and segments as the map of the next registration.
+    * The data and map clouds and segments are swapped, the segment pair table of the data is kept for the map,
+    * so successive scans only compute the table of the new data. Set the new data cloud and segments afterwards.
+    */
+  void
+  dataAsMap();
+
+  /** \brief Set a prior of the transformation from data to map, e.g. from odometry. The area consistent pairs, the
+    * rotations of two pairs and the translations of three pairs which are not within prior_gate standard deviations of
+    * the prior are not generated. The cross-covariance between rotation and translation is not used.
+    * \param[in] rotation the prior rotation
+    * \param[in] translation the prior translation
+    * \param[in] covariance covariance of the rotation error (rotation vector, in radians) and the translation error,
+    * the upper left and lower right blocks of a 6x6 covariance
+    */
+  void
+  setPosePrior(const Matrix3d &rotation, const Vector3d &translation, const Matrix6d &covariance);
+
+  /** \brief Remove the pose prior, all hypotheses are generated again. */
+  void
+  clearPosePrior();
+
+  bool
+  hasPosePrior() const {return has_pose_prior_;}
+
   /**
    * @b Rotate a given point cloud with given rotation matrix in SO(3).
    * @param[in] input boost shared pointer to the given point cloud which will be rotated
@@ -289,7 +575,11 @@ class Registration
 
 
 
-  void
+  /** \brief Register the data segments to the map segments.
+    * \return false if no solution was found, the identity transformation is the result and the data cloud is
+    *         not transformed then
+    */
+  bool
   execute();
 
   Vector3d
@@ -297,6 +587,17 @@ class Registration
   Matrix3d
   rotation () {return rotation_;}
 
+  /** \brief The fraction of the area of the big data segments which is explained by the correspondences of the result. */
+  double
+  score () const {return score_;}
+
+  /** \brief The fraction of the hypothesis search space which was explored by the last execute (),
+    * less than 1 if the time budget or the confidence threshold stopped the search or the final re-scoring early,
+    * 0 if the time budget ran out before the first hypothesis was scored.
+    */
+  double
+  exploredFraction () const {return explored_fraction_;}
+
   /**
    * @b Set the parameters for the registration algorithm.
    * @params[in] param registration parameters
@@ -310,7 +611,8 @@ class Registration
     params_.unparallel_min_angle = params_.unparallel_min_angle * M_PI / 180;
     params_.side_rotation_ability = params_.side_rotation_ability * M_PI / 180;
     params_.merge_angle = params_.merge_angle * M_PI / 180;
-
+    map_relations_dirty_ = true;
+    data_relations_dirty_ = true;
   }
 
   /** @b Visualize the planar surface correspondences between the two given point clouds.
@@ -322,32 +624,119 @@ class Registration
   void
   visualizeCorrespondencesWithPoints();
 
+  /** \brief Find the pairs sharing a map or a data segment with another pair.
+    * \param[in] pairs the correspondences
+    * \param[in] pair_num the number of correspondences
+    * \param[in,out] buffers buffers.keep is 0 for the conflicting pairs and 1 otherwise, buffers.rows and buffers.cols
+    *                hold the sorted map and data segments of the conflicting pairs
+    * \return whether there is any conflict
+    */
+  static bool
+  markConflictingPairs (const AreaConsistentPair *pairs, int pair_num, AssignmentBuffers &buffers);
+
+  /** \brief Minimum cost assignment between the rows and the columns of a dense cost matrix, by the Hungarian method.
+    * \param[in] costs the row-major cost matrix
+    * \param[in] row_num the number of rows
+    * \param[in] col_num the number of columns
+    * \param[in,out] buffers the state of the method, buffers.row_to_col holds the column of every row or -1
+    */
+  static void
+  solveAssignment (const std::vector<double> &costs, int row_num, int col_num, AssignmentBuffers &buffers);
+
 private:
   /**
    * @b Find area consistent planes. Suppose \f$p_l\f$ is a plane from the
    * left hand side point cloud, and \f$p_r\f$ is a plane from the right
    * hand side point cloud, they are considered as area-consistent
    * if \f$(p_l.s-p_r.s)/max(p_l.s, p_r.s)<max_dif\f$
+   * The data segments are sorted by area, so only the area range of each map segment is tested.
    * @param[in] max_dif the threshold for determine area consistent.
    */
   void
   findAreaConsistentPlanes(double max_dif);
 
+  /** \brief Recompute the segment pair tables of the big segments whose segments or parameters changed. */
+  void
+  updateSegmentPairTables();
+
   /** filter out planar segment with almost linear shape. */
   bool
   filterByLinearity(double value);
 
-  /** @ Find all possible 3 non-parallel planar segment triplets.*/
+  /** @ Find all possible 3 non-parallel planar segment triplets.
+    * The first out loop runs on params_.threads threads, the accumulation of the third pairs and the removal of
+    * duplicate triplets are serial, the result does not depend on the number of threads.*/
   void
   findAreaConsistentPairTriplets(double simple_translation_test_threshold,
                                  double min_angle,
                                  double max_angle);
 
-  /** @b Find all potential solutions according to a minmum required concensus set size. */
+  /** \brief Find the third pair candidates whose first area consistent pair is the given one, in the order of the serial loops.
+    * \param[in] first index of the first area consistent pair
+    * \param[in] simple_translation_test_threshold threshold of the simple translation agreement test
+    * \param[in] cos_min_angle cosine of the minimum angle between non-parallel segments
+    * \param[in] cos_max_angle cosine of the maximum angle between non-parallel segments
+    * \param[in] buffers candidate buffers of the calling thread
+    * \param[out] hypotheses the candidates are appended, the ones of the same second pair are consecutive
+    */
+  void
+  findPairTripletsOfFirstPair(int first,
+                              double simple_translation_test_threshold,
+                              double cos_min_angle,
+                              double cos_max_angle,
+                              TripletSearchBuffers &buffers,
+                              std::vector<PairTripletHypothesis> &hypotheses);
+
+  /** \brief Test on the mass centers of two area consistent pairs, given the rotation errors of their normals.
+    * The offset between the two mass centers, measured along the normal of either segment, should agree in both scans
+    * within the overlapping radii of the pairs and the rotation error of that normal. The overlapping tests of a
+    * hypothesis containing both pairs, with a rotation of these errors, can only pass if this test passes.
+    * \param[in] pair1 the first area consistent pair
+    * \param[in] pair2 the second area consistent pair
+    * \param[in] chord1 distance between the rotated data normal and the map normal of the first pair
+    * \param[in] chord2 distance between the rotated data normal and the map normal of the second pair
+    */
+  bool
+  massCenterOffsetsAgree (const AreaConsistentPair &pair1,
+                          const AreaConsistentPair &pair2,
+                          double chord1,
+                          double chord2);
+
+  /** \brief The number of threads to use, 1 if OpenMP is not available. */
+  int
+  numberOfThreads () const;
+
+  /** @b Find all potential solutions according to a minmum required concensus set size.
+    * \param[in] anytime stop at the deadline or once a solution reaches params_.min_confidence,
+    *            the hypotheses are expected to be ordered by their area in this case.
+    */
   void
-  findPotentialSolutions();
+  findPotentialSolutions(bool anytime = false);
+
+  /** \brief Whether a time budget or a confidence threshold is set. */
+  bool
+  anytimeMode () const
+  {
+    return (params_.time_budget > 0.0 || params_.min_confidence > 0.0);
+  }
+
+  /** \brief Whether the time budget of the current execute () is used up. */
+  bool
+  deadlineReached () const;
+
+  /** \brief The fraction of the area of the big data segments covered by the correspondences of a solution. */
+  double
+  explainedArea (const Solution &solution);
+
+  /** \brief The product of the map and data segment areas of a pair, as used for ranking solutions. */
+  double
+  pairArea (const AreaConsistentPair &pair) const;
 
   /** \brief Guarantee the correspondences are unique, in other words, there is no segment which corresponds to multiple segments.
+    * The pairs sharing a segment are resolved as an assignment problem: the most correspondences are kept, and among
+    * those the ones with the smallest total distance between the transformed mass centers. Pairs without any conflict
+    * are always kept. Conflicts bigger than max_assignment_size on a side are resolved greedily by distance instead.
+    * The result does not depend on the order of the correspondences, the kept ones stay in their order.
     *@param[in] solution the solution whose correspondences will be checked if unique.*/
   void
   ensureUniqueMapping(Solution &solution);
@@ -391,22 +780,27 @@ private:
   rotationFromTwoCorrespondencePairs(AreaConsistentPair pair1, AreaConsistentPair pair2);
 
   /**
-   * @b Refine the rotation of a solution using least squares based on SVD.
+   * @b Check the rotation of a solution against the least squares rotation of all its correspondences, based on SVD.
+   * The solution is not modified.
    * @param[in] solution the given solution with plane correspondences.
    * @param[in] value the difference between the translation found by initial three-non-planar-segments and found by all
    *            correspondences should not be larger than this threshold
    */
   bool
-  findRotation(Solution solution, double value);
+  findRotation(const Solution &solution, double value);
+
+  bool
+  findRotation(const AreaConsistentPair *correspondences, size_t size, const Matrix3d &initial_rotation, double value);
 
   /**
-   * @b Refine the translation of a solution using least squares based on ColPivHouseholderQR.
+   * @b Check the translation of a solution against the least squares translation of all its correspondences,
+   * based on ColPivHouseholderQR. The solution is not modified.
    * @param[in] solution the given solution with plane correspondences
    * @param[in] value the difference between the translation found by initial three-non-planar-segments and found by all
    *             correspondences should not be larger than this threshold
    */
   bool
-  findTranslation(Solution solution, double value);
+  findTranslation(const Solution &solution, double value);
 
 
   /** @b The initial rotation and translation was computed by freezing two and three correspondences, respectively.
@@ -421,8 +815,31 @@ private:
   bool
   findOptimumSolution();
 
+  /** \brief Keep only the solutions of the first k keys, in the order of the keys.
+    * \param[in] keys (score, index) keys of the solutions, ordered as the solutions should be
+    * \param[in] k the number of solutions to keep
+    */
   void
-  point2plane(Solution solution);
+  keepSolutions(const std::vector<std::pair<double, int> > &keys, size_t k);
+
+  /** \brief The sum of the map and data area products of the correspondences of a solution. */
+  double
+  solutionArea(const Solution &solution) const;
+
+  /** \brief Refine a solution by point-to-plane Gauss-Newton steps, the data points of every correspondence are
+    * fitted to the plane of its map segment. At most refine_iterations steps are made, stopping early once the update
+    * is negligible. With a refine_tolerance, every data segment is subsampled in equal strides of its points, with as
+    * many samples as needed for the standard deviation of its plane offset to stay below the tolerance.
+    * \param[in,out] solution the solution to refine
+    */
+  void
+  point2plane(Solution &solution);
+
+  /** \brief Number of refinement samples of a data segment for the refine_tolerance, from its plane covariance,
+    * or from its scatter matrix if the covariance is not available.
+    */
+  int
+  refinementSampleNumber (const PlanarSegment &segment) const;
 
   bool
   exceedLocomotionAbility(Matrix3d rotation);
@@ -430,6 +847,25 @@ private:
   bool
   exceedLocomotionAbility(Vector3d translation);
 
+  /** \brief Test a pair against the pose prior, the data normal rotated by the prior should agree with the map normal,
+    * and the bias predicted by the prior translation with the map bias, up to the gate. Both orientations of the data
+    * segment are tried, as in findPotentialSolutions.
+    */
+  bool
+  priorAdmitsPair(const PlanarSegment &map_segment, const PlanarSegment &data_segment) const;
+
+  /** \brief Compute the gates of the pose prior from its covariance and the current parameters. */
+  void
+  updatePosePriorGates();
+
+  /** \brief Mahalanobis gate of a hypothesis rotation against the pose prior. */
+  bool
+  priorAdmitsRotation(const Matrix3d &rotation) const;
+
+  /** \brief Mahalanobis gate of a hypothesis translation against the pose prior. */
+  bool
+  priorAdmitsTranslation(const Vector3d &translation) const;
+
 private:
   PointCloudPtr map_cloud_;
   PointCloudPtr data_cloud_;
@@ -444,17 +880,60 @@ private:
   PlanarSegment::StdVectorPtr big_data_segments_;
   AreaConsistentPair::StdVectorPtr area_consistent_planes_;
   RCPPPair::StdVectorPtr rotation_consistent_pairs_;
+  /** pairwise relations of the big map and data segments, rebuilt only if the segments or parameters changed. */
+  SegmentPairTable map_relations_;
+  SegmentPairTable data_relations_;
+  bool map_relations_dirty_;
+  bool data_relations_dirty_;
+  /** angle signature index of the big data segments, built together with data_relations_. */
+  AngleSignatureIndex data_angle_index_;
+  /** wall-clock time in seconds at which the hypothesis search of the current execute () stops, if budgeted. */
+  double deadline_;
+  double score_;
+  double explored_fraction_;
+  /** index of the area consistent pair (map i, data j) at i * big_data_segments_->size () + j, -1 if they are not consistent. */
+  std::vector<int> area_consistent_pair_lookup_;
+  /** the data segments sorted by area and the candidates of one map segment, kept between execute () calls. */
+  std::vector<std::pair<double, int> > data_area_order_;
+  std::vector<int> area_candidates_;
   AreaConsistentPair::StdVector single_rotation_consistents_;
   AreaConsistentPair::StdVector single_translation_consitents_;
   std::vector<AreaConsistentPair::StdVector> all_rotation_consistents_;
   std::vector<AreaConsistentPair::StdVector> all_translation_consistents_;
   std::vector<Solution> solutions_;
-  boost::unordered_set<AreaConsistentPairTriplets> area_consistent_pair_triplets_;
+  /** the correspondences of all solutions, reset by every execute (). */
+  HypothesisPool hypothesis_pool_;
+  /** buffers of the hypothesis search and scoring, kept between execute () calls to avoid reallocation. */
+  std::vector<Solution> scored_solutions_;
+  std::vector<Solution> kept_solutions_;
+  std::vector<std::pair<double, int> > solution_keys_;
+  std::vector<TripletSearchBuffers> search_buffers_;
+  std::vector<std::vector<PairTripletHypothesis> > triplet_slots_;
+  PairTripletSet area_consistent_pair_triplets_;
+  AreaConsistentPair::StdVector accumulated_pairs_;
+  std::vector<std::pair<double, int> > first_pair_order_;
+  std::vector<std::pair<double, int> > triplet_order_;
+  AssignmentBuffers assignment_buffers_;
+  /** the sampled data points of the refinement and the map segments they are fitted to. */
+  std::vector<Vector3d> refinement_points_;
+  std::vector<int> refinement_planes_;
+  std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > refinement_hessians_;
+  std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > refinement_gradients_;
   double alpha_;
   double beta_;
   double gamma_;
   Matrix3d rotation_;
   Vector3d translation_;
+  /** the pose prior, the gates use its covariance blocks widened by the angle and bias tolerances,
+      updated by updatePosePriorGates () at the start of every execute (). */
+  bool has_pose_prior_;
+  Matrix3d prior_rotation_;
+  Vector3d prior_translation_;
+  Matrix3d prior_rotation_covariance_;
+  Matrix3d prior_translation_covariance_;
+  Matrix3d prior_rotation_information_;
+  Matrix3d prior_translation_information_;
+  double prior_rotation_sigma_;
   std::vector<Matrix3d, aligned_allocator<Matrix3d> > rotations_;
   RegistrationParameters params_;
 
@@ -54,6 +54,12 @@ namespace tams
     double max_translation_norm;
     double max_angle_diff;
     double max_bias_diff;
+    int threads;
+    double time_budget;
+    double min_confidence;
+    int refine_iterations;
+    double refine_tolerance;
+    double prior_gate;
     RegistrationParameters():
       visualization (false),
       merge_angle (0.0),
@@ -64,7 +70,13 @@ namespace tams
       side_rotation_ability (0.0),
       max_translation_norm (0.0),
       max_angle_diff (0.0),
-      max_bias_diff (0.0)
+      max_bias_diff (0.0),
+      threads (0),
+      time_budget (0.0),
+      min_confidence (0.0),
+      refine_iterations (0),
+      refine_tolerance (0.0),
+      prior_gate (3.0)
     {
     }
   };
@@ -38,14 +38,21 @@
  */
 //STL
 #include <algorithm>
+#include <limits>
 #include <fstream>
+#include <sys/time.h>
 //Eigen
 #include <Eigen/Core>
 #include <Eigen/SVD>
+#include <Eigen/Eigenvalues>
 #include <Eigen/Geometry>
 //PCL
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/visualization/point_cloud_handlers.h>
+//OpenMP
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 //TAMS
 #include "registration/registration.h"
 #include "common/rgb.h"
@@ -53,6 +60,39 @@
 #include "common/planar_patch.h"
 
 using namespace tams;
+
+namespace
+{
+  /** wall-clock time in seconds, boost::timer measures the processor time of all threads. */
+  double
+  wallTime ()
+  {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (tv.tv_sec + tv.tv_usec * 1e-6);
+  }
+
+  /** sets element n of segments, which is at most its size, to the given segment.
+      An existing element is assigned, which keeps the memory of its point indices. */
+  void
+  setSegment (PlanarSegment::StdVector &segments, size_t n, const PlanarSegment &segment)
+  {
+    if (n < segments.size ())
+      segments[n] = segment;
+    else
+      segments.push_back (segment);
+  }
+
+  /** orders (score, index) keys by decreasing score, equal scores keep their index order. */
+  bool
+  higherScore (const std::pair<double, int> &lhs, const std::pair<double, int> &rhs)
+  {
+    if (lhs.first != rhs.first)
+      return (lhs.first > rhs.first);
+    return (lhs.second < rhs.second);
+  }
+}
+
 void
 Registration::colorEncoding (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud,
                              pcl::PointCloud<pcl::PointXYZRGB>::Ptr output,
@@ -129,27 +169,132 @@ Registration::exceedLocomotionAbility(Vector3d translation)
   return false;
 }
 
+void
+Registration::setPosePrior(const Matrix3d &rotation, const Vector3d &translation, const Matrix6d &covariance)
+{
+  has_pose_prior_ = true;
+  prior_rotation_ = rotation;
+  prior_translation_ = translation;
+  prior_rotation_covariance_ = covariance.topLeftCorner<3,3>();
+  prior_translation_covariance_ = covariance.bottomRightCorner<3,3>();
+}
+
+void
+Registration::clearPosePrior()
+{
+  has_pose_prior_ = false;
+}
+
+void
+Registration::updatePosePriorGates()
+{
+  if (!has_pose_prior_)
+    return;
+  /** the tolerances of the plane parameters are added as isotropic variances, so a certain prior still admits the noise. */
+  Matrix3d rotation_covariance = prior_rotation_covariance_ + Matrix3d::Identity() * params_.max_angle_diff * params_.max_angle_diff;
+  Matrix3d translation_covariance = prior_translation_covariance_ + Matrix3d::Identity() * params_.max_bias_diff * params_.max_bias_diff;
+  prior_rotation_information_ = rotation_covariance.inverse();
+  prior_translation_information_ = translation_covariance.inverse();
+  SelfAdjointEigenSolver<Matrix3d> eigensolver (prior_rotation_covariance_, EigenvaluesOnly);
+  prior_rotation_sigma_ = sqrt(std::max(eigensolver.eigenvalues()(2), 0.0));
+}
+
+bool
+Registration::priorAdmitsPair(const PlanarSegment &map_segment, const PlanarSegment &data_segment) const
+{
+  /** the normal angle is gated by the biggest rotation standard deviation, the bias by the translation variance along the map normal. */
+  double max_angle = params_.max_angle_diff + params_.prior_gate * prior_rotation_sigma_;
+  double cos_max_angle = max_angle < M_PI ? cos(max_angle) : -1.0;
+  double bias_sigma = sqrt(map_segment.normal.dot(prior_translation_covariance_ * map_segment.normal));
+  double max_bias_diff = params_.max_bias_diff + params_.prior_gate * bias_sigma;
+
+  double cos_angle = (prior_rotation_ * data_segment.normal).dot(map_segment.normal);
+  double predicted = map_segment.normal.dot(prior_translation_) - map_segment.bias;
+  if (cos_angle >= cos_max_angle && fabs(predicted + data_segment.bias) <= max_bias_diff)
+    return true;
+  /** the data segment seen from the other side, (n,d) = (-n,-d). */
+  if (-cos_angle >= cos_max_angle && fabs(predicted - data_segment.bias) <= max_bias_diff)
+    return true;
+  return false;
+}
+
+bool
+Registration::priorAdmitsRotation(const Matrix3d &rotation) const
+{
+  if (!has_pose_prior_)
+    return true;
+  AngleAxisd error (rotation * prior_rotation_.transpose());
+  Vector3d e = error.angle() * error.axis();
+  return (e.dot(prior_rotation_information_ * e) <= params_.prior_gate * params_.prior_gate);
+}
+
+bool
+Registration::priorAdmitsTranslation(const Vector3d &translation) const
+{
+  if (!has_pose_prior_)
+    return true;
+  Vector3d e = translation - prior_translation_;
+  return (e.dot(prior_translation_information_ * e) <= params_.prior_gate * params_.prior_gate);
+}
 
 void
 Registration::findAreaConsistentPlanes(double max_dif)
 {
   area_consistent_planes_->clear();
-  PlanarSegment::StdVector::iterator map_it;
-  PlanarSegment::StdVector::iterator data_it;
+  int map_num = static_cast<int> (big_map_segments_->size ());
+  int data_num = static_cast<int> (big_data_segments_->size ());
+  area_consistent_pair_lookup_.assign (map_num * data_num, -1);
+
+  /** data segments sorted by area, the area consistent ones of a map segment are in a contiguous range. */
+  std::vector<std::pair<double, int> > &data_areas = data_area_order_;
+  data_areas.resize (data_num);
+  for (int j = 0; j < data_num; j++)
+    data_areas[j] = std::make_pair ((*big_data_segments_)[j].area, j);
+  std::sort (data_areas.begin (), data_areas.end ());
+
+  std::vector<int> &candidates = area_candidates_;
   double dif;
-  for (map_it = big_map_segments_->begin(); map_it != big_map_segments_->end(); map_it++)
+  int gated_num = 0;
+  for (int i = 0; i < map_num; i++)
   {
-    for (data_it = big_data_segments_->begin(); data_it != big_data_segments_->end(); data_it++)
+    const PlanarSegment &map_segment = (*big_map_segments_)[i];
+    /** |a_l - a_r| / max(a_l, a_r) < max_dif is equivalent to a_l(1 - max_dif) < a_r < a_l / (1 - max_dif),
+        the range is slightly widened and the exact test is repeated below. */
+    double lower = map_segment.area * (1.0 - max_dif) * (1.0 - 1e-9);
+    std::vector<std::pair<double, int> >::iterator first =
+        std::lower_bound (data_areas.begin (), data_areas.end (), std::make_pair (lower, -1));
+    std::vector<std::pair<double, int> >::iterator last = data_areas.end ();
+    if (max_dif < 1.0)
+    {
+      double upper = map_segment.area / (1.0 - max_dif) * (1.0 + 1e-9);
+      last = std::upper_bound (first, data_areas.end (), std::make_pair (upper, data_num));
+    }
+
+    candidates.clear ();
+    for (; first != last; first++)
+      candidates.push_back (first->second);
+    std::sort (candidates.begin (), candidates.end ());
+
+    for (size_t k = 0; k < candidates.size (); k++)
     {
-      dif = fabs(map_it->area - data_it->area)/std::max(map_it->area, data_it->area);
+      const PlanarSegment &data_segment = (*big_data_segments_)[candidates[k]];
+      dif = fabs(map_segment.area - data_segment.area)/std::max(map_segment.area, data_segment.area);
       //dif = 2.0f * fabs(map_it->area - data_it->area)/(map_it->area + data_it->area);
       if (dif < max_dif)
       {
-        area_consistent_planes_->push_back(AreaConsistentPair(map_it - big_map_segments_->begin(), data_it - big_data_segments_->begin()));
+        if (has_pose_prior_ && !priorAdmitsPair (map_segment, data_segment))
+        {
+          gated_num++;
+          continue;
+        }
+        area_consistent_pair_lookup_[i * data_num + candidates[k]] = static_cast<int> (area_consistent_planes_->size ());
+        area_consistent_planes_->push_back(AreaConsistentPair(i, candidates[k]));
       }
     }
   }
   PCL_INFO ("%d area consistent planes have been found.\n", area_consistent_planes_->size());
+  if (has_pose_prior_)
+    PCL_INFO ("%d area consistent planes disagree with the pose prior.\n", gated_num);
 }
 
 
@@ -247,20 +392,20 @@ Registration::filterByLinearity (double value)
 void
 Registration::getBigSegments(double min_area)
 {
-  PlanarSegment pp;
   PlanarSegment::StdVector::iterator it;
-  big_map_segments_->clear();
-  big_data_segments_->clear();
+  size_t map_num = 0, data_num = 0;
   for (it = map_segments_->begin(); it != map_segments_->end() ; it++)
   {
     if (it->area > min_area)
-      big_map_segments_->push_back(*it);
+      setSegment (*big_map_segments_, map_num++, *it);
   }
   for (it = data_segments_->begin(); it != data_segments_->end() ; it++)
   {
     if (it->area > min_area)
-      big_data_segments_->push_back(*it);
+      setSegment (*big_data_segments_, data_num++, *it);
   }
+  big_map_segments_->resize (map_num);
+  big_data_segments_->resize (data_num);
   PCL_INFO ("There are %d and %d segments with area bigger than %f in the map cloud and data cloud respectively.\n",
             big_map_segments_->size(), big_data_segments_->size(), min_area);
 }
@@ -272,8 +417,6 @@ Registration::getBigSegments(int N)
   PlanarSegment pp;
   PlanarSegment::StdVector::iterator it_i;
   PlanarSegment::StdVector::iterator it_j;
-  big_map_segments_->clear();
-  big_data_segments_->clear();
   for (it_i = map_segments_->begin(); it_i != map_segments_->end() -1 ; it_i++)
   {
     for (it_j = it_i + 1; it_j < map_segments_->end(); it_j++)
@@ -286,7 +429,9 @@ Registration::getBigSegments(int N)
       }
     }
   }
-  big_map_segments_->insert(big_map_segments_->begin(), map_segments_->begin(), map_segments_->begin() + N);
+  for (int k = 0; k < N; k++)
+    setSegment (*big_map_segments_, k, (*map_segments_)[k]);
+  big_map_segments_->resize (N);
 
   for (it_i = data_segments_->begin(); it_i != data_segments_->end()-1; it_i++)
   {
@@ -300,7 +445,9 @@ Registration::getBigSegments(int N)
       }
     }
   }
-  big_data_segments_->insert(big_data_segments_->begin(), data_segments_->begin(), data_segments_->begin() + N);
+  for (int k = 0; k < N; k++)
+    setSegment (*big_data_segments_, k, (*data_segments_)[k]);
+  big_data_segments_->resize (N);
 
   for (it_i = big_map_segments_->begin(); it_i != big_map_segments_->end(); it_i++)
   {
@@ -315,10 +462,16 @@ Registration::getBigSegments(int N)
 }
 
 bool
-Registration::findRotation(Solution solution, double value)
+Registration::findRotation(const Solution &solution, double value)
+{
+  return (findRotation (solution.correspondences.begin (), solution.correspondences.size (), solution.rotation, value));
+}
+
+bool
+Registration::findRotation(const AreaConsistentPair *correspondences, size_t size, const Matrix3d &initial_rotation, double value)
 {
   Matrix3d rotation = Matrix3d::Zero();
-  AreaConsistentPair::StdVector::iterator it;
+  const AreaConsistentPair *it;
   Matrix3d S = Matrix3d::Zero();
   //double total_area = solution.total_area;
   PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
@@ -326,7 +479,7 @@ Registration::findRotation(Solution solution, double value)
   PlanarSegment::StdVector::iterator map_it;
   PlanarSegment::StdVector::iterator data_it;
   double weight = 0;
-  for (it = solution.correspondences.begin(); it != solution.correspondences.end(); it++)
+  for (it = correspondences; it != correspondences + size; it++)
   {
     map_it = map_begin + it->lhs;
     data_it = data_begin + it->rhs;
@@ -343,39 +496,38 @@ Registration::findRotation(Solution solution, double value)
 
   if (DEBUG)
   {
-    std::cout << "difference between initial and refined rotation: \n" << rotation - solution.rotation << std::endl;
+    std::cout << "difference between initial and refined rotation: \n" << rotation - initial_rotation << std::endl;
   }
 
-  double norm1distance = (rotation - solution.rotation).cwiseAbs().sum();
+  double norm1distance = (rotation - initial_rotation).cwiseAbs().sum();
   if (norm1distance > value)
   {
     return false;
   }
 
-  solution.rotation = rotation;
   return true;
 }
 
 bool
-Registration::findTranslation(Solution solution, double value)
+Registration::findTranslation(const Solution &solution, double value)
 {
   PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
   PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
   PlanarSegment::StdVector::iterator map_it;
   PlanarSegment::StdVector::iterator data_it;
-  AreaConsistentPair::StdVector::iterator it;
+  CorrespondenceRange::iterator it;
   Vector3d translation = Vector3d::Zero();
-  MatrixXd A(solution.correspondences.size(),3);
-  VectorXd b(solution.correspondences.size());
-  int i = 0;
+  /** the least squares problem is accumulated in its 3x3 normal equations, which need no dynamic allocation. */
+  Matrix3d AtA = Matrix3d::Zero();
+  Vector3d Atb = Vector3d::Zero();
   for (it = solution.correspondences.begin(); it != solution.correspondences.end(); it++)
   {
-    A.row(i) = (map_begin + it->lhs)->normal.transpose();
-    b(i) = (map_begin + it->lhs)->bias - (data_begin + it->rhs)->bias;
-    //std::cout << A.row(i).dot(solution.translation) - b(i) << " ";
-    i++;
+    const Vector3d &normal = (map_begin + it->lhs)->normal;
+    double b = (map_begin + it->lhs)->bias - (data_begin + it->rhs)->bias;
+    AtA += normal * normal.transpose();
+    Atb += b * normal;
   }
-  translation = A.colPivHouseholderQr().solve(b);
+  translation = AtA.colPivHouseholderQr().solve(Atb);
   if (DEBUG)
   {
     std::cout << "difference between initial refined translation:\n" << (solution.translation - translation).transpose() << std::endl;
@@ -388,17 +540,19 @@ Registration::findTranslation(Solution solution, double value)
     return false;
   }
 
-  solution.translation = translation;
   return true;
 }
 
-void
+bool
 Registration::execute()
 {
   DEBUG = false;
   boost::timer time;
+  deadline_ = wallTime () + params_.time_budget;
+  explored_fraction_ = 1.0;
+  score_ = 0.0;
   solutions_.clear();
-  area_consistent_pair_triplets_.clear ();
+  hypothesis_pool_.reset ();
   getBigSegments(params_.min_area);
 
   //filterByLinearity (50.0);
@@ -408,6 +562,9 @@ Registration::execute()
     mergeSurfacesOnSameInfinitePlane(cos(params_.merge_angle), params_.merge_dis);
   }
 
+  updateSegmentPairTables ();
+  updatePosePriorGates ();
+
   //find all area-consistent planar segment pairs, in this setp, one segment can be consistent with multiple segments in another point cloud
   time.restart ();
   findAreaConsistentPlanes(params_.max_area_diff);
@@ -420,8 +577,16 @@ Registration::execute()
 
   //find all potential solutions.
   time.restart ();
-  findPotentialSolutions();
+  findPotentialSolutions(anytimeMode ());
   std::cerr << "time elapsed for finding all potential solutions: " << time.elapsed () << std::endl;
+  if (solutions_.empty ())
+  {
+    PCL_ERROR ("No solution found, the identity transformation is returned.\n");
+    rotation_ = Matrix3d::Identity();
+    translation_ = Vector3d::Zero();
+    *transformed_data_cloud_ = *data_cloud_;
+    return (false);
+  }
 
   //find the solution which maxmize the spherical correlation
   time.restart ();
@@ -431,18 +596,24 @@ Registration::execute()
   point2plane (solutions_[0]);
   rotation_ = solutions_[0].rotation;
   translation_ = solutions_[0].translation;
+  score_ = explainedArea (solutions_[0]);
 
   std::cerr << "time elapsed for refine solutions: " << time.elapsed () << std::endl;
   std::cout << "Number of correspondences: " << solutions_[0].correspondences.size() << std::endl;
+  if (anytimeMode ())
+  {
+    std::cout << "Score: " << score_ << ", explored fraction of the hypotheses: " << explored_fraction_ << std::endl;
+  }
 
 //  std::cout << "Candidate solutions number: " << solutions_.size() << std::endl;
 //  std::cout << "rotation and translation: \n";
 //  std::cout << solutions_[0].rotation << std::endl << solutions_[0].translation.transpose() << std::endl;
   transformPointcloud(data_cloud_, transformed_data_cloud_, solutions_[0].rotation, solutions_[0].translation);
+  return (true);
 }
 
 void
-Registration::findPotentialSolutions()
+Registration::findPotentialSolutions(bool anytime)
 {
   if (solutions_.empty ())
     std::cerr << "No possible solution found, possibly there is something wrong with the thresholds\n";
@@ -463,11 +634,26 @@ Registration::findPotentialSolutions()
     map_it->normal = -map_it->normal;
   }
 
-  std::vector<Solution> solutions;
+  std::vector<Solution> &solutions = scored_solutions_;
+  solutions.clear ();
 
-  for (size_t i = 0; i < solutions_.size (); i++)
+  /** In the anytime mode the hypotheses are scored from the biggest area on,
+      until the deadline is reached or the best solution so far explains enough of the data.
+      The deadline holds even if no solution is found yet, then no solution is returned. */
+  double best_confidence = 0.0;
+  size_t scored = 0;
+  for (size_t i = 0; i < solutions_.size (); i++, scored++)
   {
+    if (anytime && (deadlineReached () || (params_.min_confidence > 0.0 && best_confidence >= params_.min_confidence)))
+      break;
+    /** the correspondences of the new solution start as a copy of the hypothesis at the end of the pool. */
     Solution solution = solutions_[i];
+    solution.correspondences = hypothesis_pool_.open ();
+    for (int k = 0; k < solutions_[i].correspondences.count; k++)
+    {
+      AreaConsistentPair pair = solutions_[i].correspondences[k];
+      hypothesis_pool_.append (solution.correspondences, pair);
+    }
 
     for (AreaConsistentPair::StdVector::iterator it = area_consistent_planes_->begin (); it != area_consistent_planes_->end (); it++)
     {
@@ -485,7 +671,7 @@ Registration::findPotentialSolutions()
         continue;
 
       /** the area-consistent pair is accepted if it past all tests. */
-      solution.correspondences.push_back(*it);
+      hypothesis_pool_.append (solution.correspondences, *it);
     }
 
     for (AreaConsistentPair::StdVector::iterator it = area_consistent_planes_->begin (); it != area_consistent_planes_->end (); it++)
@@ -510,29 +696,36 @@ Registration::findPotentialSolutions()
         continue;
 
       /** the area-consistent pair is accepted if it past all tests. */
-      solution.correspondences.push_back(*it);
+      hypothesis_pool_.append (solution.correspondences, *it);
     }
 
     ensureUniqueMapping(solution);
+    hypothesis_pool_.trim (solution.correspondences);
 
-    if (solution.correspondences.size () >= 3)
+    if (solution.correspondences.size () >= 3 && findRotation (solution, 0.1) && findTranslation (solution, 0.1))
     {
-      if (findRotation (solution, 0.1) && findTranslation (solution, 0.1))
-      {
-        solutions.push_back (solution);
-      }
+      solutions.push_back (solution);
+      if (anytime && params_.min_confidence > 0.0)
+        best_confidence = std::max (best_confidence, explainedArea (solution));
+    }
+    else
+    {
+      hypothesis_pool_.release (solution.correspondences);
     }
   }
+  if (anytime && !solutions_.empty ())
+    explored_fraction_ *= static_cast<double> (scored) / solutions_.size ();
 
   if (solutions.empty ())
   {
     std::cerr << "something error happened, no concensus set with more than 3 non-parallel segments found!\n";
+    solutions_.clear ();
     return;
   }
 
   std::cerr << solutions.size () << " potential solutions have been found.\n";
-  solutions_.clear ();
-  solutions_ = solutions;
+  solutions_.swap (solutions);
+  solutions.clear ();
 }
 
 
@@ -545,17 +738,126 @@ Registration::findAreaConsistentPairTriplets(double simple_translation_test_thre
       which are utilized to avoid nearly parallel or anti-parallel planar segments, usually we use 30 and 150 degrees. */
   double cos_min_angle = cos(min_angle);
   double cos_max_angle = cos(max_angle);
+  int pair_num = static_cast<int> (area_consistent_planes_->size ());
+  int thread_num = numberOfThreads ();
+
+  /** In the anytime mode the first pairs are expanded from the biggest area on, the ones left at the deadline are skipped. */
+  bool anytime = anytimeMode ();
+  int first_num = std::max (pair_num - 1, 0);
+  std::vector<std::pair<double, int> > &first_pairs = first_pair_order_;
+  first_pairs.resize (first_num);
+  for (int i = 0; i < first_num; i++)
+    first_pairs[i] = std::make_pair (pairArea ((*area_consistent_planes_)[i]), i);
+  if (anytime)
+    std::sort (first_pairs.begin (), first_pairs.end (), higherScore);
+
+  /** The first out loop is shared by the threads with dynamic scheduling, since the later pairs have less work.
+      The third pair candidates of each first pair go to their own slot, concatenating the slots gives the serial order.
+      The slots and the candidate buffers of the threads keep their memory from the previous registration. */
+  std::vector<std::vector<PairTripletHypothesis> > &slots = triplet_slots_;
+  if (static_cast<int> (slots.size ()) < first_num)
+    slots.resize (first_num);
+  for (int k = 0; k < first_num; k++)
+    slots[k].clear ();
+  if (static_cast<int> (search_buffers_.size ()) < thread_num)
+    search_buffers_.resize (thread_num);
+  int expanded_num = 0;
+#pragma omp parallel for schedule(dynamic, 1) num_threads(thread_num) reduction(+:expanded_num)
+  for (int k = 0; k < first_num; k++)
+  {
+    if (anytime && deadlineReached ())
+      continue;
+#ifdef _OPENMP
+    TripletSearchBuffers &buffers = search_buffers_[omp_get_thread_num ()];
+#else
+    TripletSearchBuffers &buffers = search_buffers_[0];
+#endif
+    findPairTripletsOfFirstPair (first_pairs[k].second, simple_translation_test_threshold, cos_min_angle, cos_max_angle,
+                                 buffers, slots[k]);
+    expanded_num++;
+  }
+  if (first_num > 0)
+    explored_fraction_ = static_cast<double> (expanded_num) / first_num;
+
+  /** The correspondences of a first and second pair accumulate their accepted third pairs in serial order,
+      a third pair is only accepted if the least squares rotation of the correspondences so far agrees with the
+      initial rotation. The same triplet is found from up to three first-second pairs, only the first one in serial
+      order is kept and the later ones do not accumulate. Both depend on the third pairs before, so the candidates
+      of the slots are accepted here in serial order, the rotation is only recomputed when the correspondences grow. */
+  size_t candidate_num = 0;
+  for (int k = 0; k < first_num; k++)
+    candidate_num += slots[k].size ();
+  PairTripletSet &triplets = area_consistent_pair_triplets_;
+  triplets.reset (candidate_num);
+  AreaConsistentPair::StdVector &accumulated = accumulated_pairs_;
+  bool rotation_agrees = false;
+  Solution solution;
+  for (int k = 0; k < first_num; k++)
+  {
+    const std::vector<PairTripletHypothesis> &candidates = slots[k];
+    for (size_t n = 0; n < candidates.size (); n++)
+    {
+      const PairTripletHypothesis &candidate = candidates[n];
+      if (n == 0 || candidate.second != candidates[n - 1].second)
+      {
+        //the rotation test of the first two pairs alone is already passed in the search
+        accumulated.clear ();
+        accumulated.push_back (candidate.pairs[0]);
+        accumulated.push_back (candidate.pairs[1]);
+        rotation_agrees = true;
+      }
+      if (!rotation_agrees)
+        continue;
+      if (!triplets.insert (candidate.key))
+        continue;
+      accumulated.push_back (candidate.pairs[2]);
+
+      solution.correspondences = hypothesis_pool_.open ();
+      for (size_t i = 0; i < accumulated.size (); i++)
+        hypothesis_pool_.append (solution.correspondences, accumulated[i]);
+      solution.rotation = candidate.rotation;
+      solution.translation = candidate.translation;
+      solution.total_area = solutionArea (solution);
+      solutions_.push_back (solution);
+
+      rotation_agrees = findRotation (&accumulated[0], accumulated.size (), candidate.rotation, 0.1);
+    }
+  }
+
+  /** the area of a hypothesis is the sum of its pair areas, the best expected ones come first in the anytime mode. */
+  if (anytime)
+  {
+    std::vector<std::pair<double, int> > &order = triplet_order_;
+    order.resize (solutions_.size ());
+    for (size_t n = 0; n < solutions_.size (); n++)
+      order[n] = std::make_pair (solutions_[n].total_area, static_cast<int> (n));
+    std::sort (order.begin (), order.end (), higherScore);
+    std::vector<Solution> &sorted = scored_solutions_;
+    sorted.clear ();
+    for (size_t n = 0; n < order.size (); n++)
+      sorted.push_back (solutions_[order[n].second]);
+    solutions_.swap (sorted);
+    sorted.clear ();
+  }
+
+  std::cerr << solutions_.size () << " three-non-parallel pairs have been found.\n";
+}
 
-  double lhs_cos_angle = 0.0;
-  double lhs_angle = 0.0;
-  double rhs_cos_angle = 0.0;
-  double rhs_angle = 0.0;
+void
+Registration::findPairTripletsOfFirstPair(int first,
+                                          double simple_translation_test_threshold,
+                                          double cos_min_angle,
+                                          double cos_max_angle,
+                                          TripletSearchBuffers &buffers,
+                                          std::vector<PairTripletHypothesis> &hypotheses)
+{
+  double cos_max_angle_diff = cos(params_.max_angle_diff);
   double angle_dif = 0.0;
 
   Matrix3d rotation = Matrix3d::Zero();
   Vector3d translation = Vector3d::Zero();
   /** iterators which are used for planar segments access. */
-  AreaConsistentPair::StdVector::iterator it1;
+  AreaConsistentPair::StdVector::iterator it1 = area_consistent_planes_->begin() + first;
   AreaConsistentPair::StdVector::iterator it2;
   AreaConsistentPair::StdVector::iterator it3;
 
@@ -569,146 +871,322 @@ Registration::findAreaConsistentPairTriplets(double simple_translation_test_thre
   PlanarSegment::StdVector::iterator map_it3;
   PlanarSegment::StdVector::iterator data_it3;
 
-  Solution solution;
-  //int pair1_overlapping = 0, pair2_overlapping = 0, pair3_overlapping = 0;
-  /** First out loop, pick up an arbitrary area cosistent pair. */
-  for (it1 = area_consistent_planes_->begin(); it1 != area_consistent_planes_->end()-1; it1++)
+  /** the relations between segments are looked up from the tables, row it1 and it2 of each table. */
+  int map_row1 = map_relations_.index (it1->lhs, 0);
+  int data_row1 = data_relations_.index (it1->rhs, 0);
+  int map_row2, data_row2;
+
+  /** The second pairs are retrieved from the angle signature index instead of testing all pairs after it1:
+      for every map segment non-parallel to it1->lhs, the data segments whose angle to it1->rhs agrees within
+      max_angle_diff are looked up, which is the angle test below, and kept if they form an area consistent pair
+      after it1. Sorting the candidates keeps the order of the full enumeration. */
+  int map_num = map_relations_.size;
+  int data_num = data_relations_.size;
+  std::vector<int> &data_candidates = buffers.data_candidates;
+  std::vector<int> &second_pairs = buffers.second_pairs;
+  std::vector<int> &third_pairs = buffers.third_pairs;
+  second_pairs.clear ();
+  for (int lhs2 = 0; lhs2 < map_num; lhs2++)
   {
-    /** Secont out loop, pick up another area consistent pair. */
-    for (it2 = it1 + 1; it2 != area_consistent_planes_->end(); it2++)
+    if (!map_relations_.non_parallel[map_row1 + lhs2])
+      continue;
+    double lhs_angle = map_relations_.angle[map_row1 + lhs2];
+    data_candidates.clear ();
+    data_angle_index_.rangeQuery (it1->rhs, lhs_angle - params_.max_angle_diff, lhs_angle + params_.max_angle_diff, data_candidates);
+    for (size_t k = 0; k < data_candidates.size (); k++)
     {
-      solution.correspondences.clear();
-      solution.translation = Vector3d::Zero();
-      solution.rotation = Matrix3d::Identity();
+      int second = area_consistent_pair_lookup_[lhs2 * data_num + data_candidates[k]];
+      if (second <= first)
+        continue;
+      second_pairs.push_back (second);
+    }
+  }
+  std::sort (second_pairs.begin (), second_pairs.end ());
+
+  AreaConsistentPair first_two[2];
+  /** Secont out loop, pick up another area consistent pair. */
+  for (size_t second = 0; second < second_pairs.size (); second++)
+  {
+    it2 = area_consistent_planes_->begin() + second_pairs[second];
+    // there should be no duplate planar segment.
+    if (it1->lhs == it2->lhs || it1->rhs == it2->rhs)
+      continue;
+
+    map_it1 = map_begin + it1->lhs;
+    map_it2 = map_begin + it2->lhs;
+    data_it1 = data_begin + it1->rhs;
+    data_it2 = data_begin + it2->rhs;
+
+    //simple translation agreement test
+    double lhs_cos_angle = map_relations_.cos_angle[map_row1 + it2->lhs];
+    double translation_test1 =
+        fabs(map_it1->bias - data_it1->bias) - fabs(lhs_cos_angle) * fabs(map_it2->bias - data_it2->bias);
+    double translation_test2 =
+        fabs(map_it2->bias - data_it2->bias) - fabs(lhs_cos_angle) * fabs(map_it1->bias - data_it1->bias);
+    if (translation_test1 < simple_translation_test_threshold || translation_test2 < simple_translation_test_threshold)
+      continue;
+
+    //the two planes should not be parallel or anti-parallel
+    if (!map_relations_.non_parallel[map_row1 + it2->lhs] || !data_relations_.non_parallel[data_row1 + it2->rhs])
+      continue;
+
+    //the angle between two planes should remain similarly in two point clouds
+    angle_dif = fabs(map_relations_.angle[map_row1 + it2->lhs] - data_relations_.angle[data_row1 + it2->rhs]);
+    if (angle_dif > params_.max_angle_diff)
+      continue;
 
-      // there should be no duplate planar segment.
-      if (it1->lhs == it2->lhs || it1->rhs == it2->rhs)
+    rotation = rotationFromTwoCorrespondencePairs(it1,it2);
+    if (exceedLocomotionAbility(rotation) || !priorAdmitsRotation(rotation))
+      continue;
+
+    /** the least squares rotation of the two pairs should agree with the initial one, otherwise no third pair is
+        accepted for them, the accumulated correspondences are tested again when the candidates are accepted. */
+    first_two[0] = *it1;
+    first_two[1] = *it2;
+    if (findRotation (first_two, 2, rotation, 0.1) == false)
+      continue;
+
+    /** The rotation does not align the normals of the first two pairs within max_angle_diff in general, both tests
+        below use the errors of this rotation, so that they only reject hypotheses the overlapping tests would reject. */
+    double chord1 = (rotation * data_it1->normal - map_it1->normal).norm ();
+    double chord2 = (rotation * data_it2->normal - map_it2->normal).norm ();
+    if (!massCenterOffsetsAgree (*it1, *it2, chord1, chord2))
+      continue;
+
+    map_row2 = map_relations_.index (it2->lhs, 0);
+    data_row2 = data_relations_.index (it2->rhs, 0);
+    Vector3d joint_line = map_it1->normal.cross(map_it2->normal);
+    joint_line = joint_line.normalized ();
+
+    /** The third pairs have to be non-parallel to the first two and rotated onto each other within max_angle_diff,
+        together with the rotation error of the first pair, their angle signatures with respect to the first pair
+        agree within the sum of the two. */
+    double signature_tolerance = params_.max_angle_diff + 2.0 * asin (std::min (1.0, 0.5 * chord1)) + 1e-9;
+    third_pairs.clear ();
+    for (int lhs3 = 0; lhs3 < map_num; lhs3++)
+    {
+      if (!map_relations_.non_parallel[map_row1 + lhs3] || !map_relations_.non_parallel[map_row2 + lhs3])
         continue;
+      double lhs_angle = map_relations_.angle[map_row1 + lhs3];
+      data_candidates.clear ();
+      data_angle_index_.rangeQuery (it1->rhs, lhs_angle - signature_tolerance, lhs_angle + signature_tolerance, data_candidates);
+      for (size_t k = 0; k < data_candidates.size (); k++)
+      {
+        int third = area_consistent_pair_lookup_[lhs3 * data_num + data_candidates[k]];
+        if (third >= 0)
+          third_pairs.push_back (third);
+      }
+    }
+    std::sort (third_pairs.begin (), third_pairs.end ());
 
-      map_it1 = map_begin + it1->lhs;
-      map_it2 = map_begin + it2->lhs;
-      data_it1 = data_begin + it1->rhs;
-      data_it2 = data_begin + it2->rhs;
-
-      //simple translation agreement test
-      double translation_test1 =
-          fabs(map_it1->bias - data_it1->bias) - fabs(map_it1->normal.dot(map_it2->normal)) * fabs(map_it2->bias - data_it2->bias);
-      double translation_test2 =
-          fabs(map_it2->bias - data_it2->bias) - fabs(map_it1->normal.dot(map_it2->normal)) * fabs(map_it1->bias - data_it1->bias);
-      if (translation_test1 < simple_translation_test_threshold || translation_test2 < simple_translation_test_threshold)
+    //inner loop
+    for (size_t third = 0; third < third_pairs.size (); third++)
+    {
+      it3 = area_consistent_planes_->begin() + third_pairs[third];
+      // there should be no duplicate area-consistent-pair
+      if (it3 == it1 || it3 == it2)
+        continue;
+      //there should be no duplicate planar segment
+      if (it3->lhs == it1->lhs || it3->rhs == it1->rhs)
+        continue;
+      if (it3->lhs == it2->lhs || it3->rhs == it2->rhs)
         continue;
 
-      //the two planes should not be parallel or anti-parallel
-      lhs_cos_angle = map_it1->normal.dot(map_it2->normal);
-      rhs_cos_angle = data_it1->normal.dot(data_it2->normal);
-      if (lhs_cos_angle > cos_min_angle || lhs_cos_angle < cos_max_angle || rhs_cos_angle > cos_min_angle || rhs_cos_angle < cos_max_angle)
+      map_it3 = map_begin + it3->lhs;
+      data_it3 = data_begin + it3->rhs;
+      if ((rotation * data_it3->normal).dot(map_it3->normal) < cos_max_angle_diff)
+        continue;
+      //planes should not be parallel or antpii-parallel to the first two planes
+      if (!map_relations_.non_parallel[map_row1 + it3->lhs] || !data_relations_.non_parallel[data_row1 + it3->rhs])
+        continue;
+      if (!map_relations_.non_parallel[map_row2 + it3->lhs] || !data_relations_.non_parallel[data_row2 + it3->rhs])
         continue;
 
-      //the angle between two planes should remain similarly in two point clouds
-      angle_dif = fabs(acos(lhs_cos_angle)-acos(rhs_cos_angle));
-      if (angle_dif > params_.max_angle_diff)
+      /** The three normal vectors should not be on an infinite plane.
+        * A vector parallel to the joint line of plane 1 and plane 2 can be computed as joint_line = normal_1.cross(normal_2).
+        * The nomals are not on the same plane if this joint line is not parallel to plane 3.
+        * In order to perform this test, the joint line is normalized and fixed to the origin, then it is projected to plane 3.
+        * Afterwards, the angle between it and its projection on plane 3 is computed.
+        */
+      double dis_origin2plane = -map_it3->bias;
+      double dis_endpoint2plane = joint_line.dot(map_it3->normal) - map_it3->bias;
+      Vector3d projection_origin2plane = -dis_origin2plane * map_it3->normal;
+      Vector3d projection_endpoint2plane = joint_line - dis_endpoint2plane * map_it3->normal;
+      Vector3d projection = projection_endpoint2plane - projection_origin2plane;
+      double cos_angle = projection.norm ();
+      if (cos_angle > cos_min_angle || cos_angle < cos_max_angle)
         continue;
 
-      rotation = rotationFromTwoCorrespondencePairs(it1,it2);
-      if (exceedLocomotionAbility(rotation))
+      translation = translationFromThreeCorrespondencePairs(it1, it2, it3);
+      if (exceedLocomotionAbility(translation) || !priorAdmitsTranslation(translation))
         continue;
-      solution.correspondences.push_back(*it1);
-      solution.correspondences.push_back(*it2);
-      solution.rotation = rotation;
 
-      //inner loop
-      for (it3 = area_consistent_planes_->begin(); it3 != area_consistent_planes_->end(); it3++)
-      {
-        // there should be no duplicate area-consistent-pair
-        if (it3 == it1 || it3 == it2)
-          continue;
-        //there should be no duplicate planar segment
-        if (it3->lhs == it1->lhs || it3->rhs == it1->rhs)
-          continue;
-        if (it3->lhs == it2->lhs || it3->rhs == it2->rhs)
-          continue;
+      if (overlapping(*it1, rotation, translation) == false)
+        continue;
+      if (overlapping(*it2, rotation, translation) == false)
+        continue;
+      if (overlapping(*it3, rotation, translation) == false)
+        continue;
 
-        map_it3 = map_begin + it3->lhs;
-        data_it3 = data_begin + it3->rhs;
-        if ((rotation * data_it3->normal).dot(map_it3->normal) < cos(params_.max_angle_diff))
-          continue;
-        //planes should not be parallel or antpii-parallel to the first two planes
-        lhs_cos_angle = map_it3->normal.dot(map_it1->normal);
-        rhs_cos_angle = data_it3->normal.dot(data_it1->normal);
-        if (lhs_cos_angle > cos_min_angle || lhs_cos_angle < cos_max_angle || rhs_cos_angle > cos_min_angle || rhs_cos_angle < cos_max_angle)
-          continue;
-        lhs_cos_angle = map_it3->normal.dot(map_it2->normal);
-        rhs_cos_angle = data_it3->normal.dot(data_it2->normal);
-        if (lhs_cos_angle > cos_min_angle || lhs_cos_angle < cos_max_angle || rhs_cos_angle > cos_min_angle || rhs_cos_angle < cos_max_angle)
-          continue;
+      //sort it1,it2 and it3 in order to reach a unique combination.
+      PairTripletHypothesis hypothesis;
+      int index1 = it1 - area_consistent_planes_->begin();
+      int index2 = it2 - area_consistent_planes_->begin();
+      int index3 = it3 - area_consistent_planes_->begin();
+      if (index3 > index2)
+        hypothesis.key = AreaConsistentPairTriplets (index1, index2, index3);
+      else if (index3 < index1)
+        hypothesis.key = AreaConsistentPairTriplets (index3, index1, index2);
+      else
+        hypothesis.key = AreaConsistentPairTriplets (index1, index3, index2);
+      hypothesis.second = index2;
+      hypothesis.pairs[0] = *it1;
+      hypothesis.pairs[1] = *it2;
+      hypothesis.pairs[2] = *it3;
+      hypothesis.rotation = rotation;
+      hypothesis.translation = translation;
+      hypotheses.push_back (hypothesis);
+    }//inner loop
+  }//second outer loop
+}
 
-        /** The three normal vectors should not be on an infinite plane.
-          * A vector parallel to the joint line of plane 1 and plane 2 can be computed as joint_line = normal_1.cross(normal_2).
-          * The nomals are not on the same plane if this joint line is not parallel to plane 3.
-          * In order to perform this test, the joint line is normalized and fixed to the origin, then it is projected to plane 3.
-          * Afterwards, the angle between it and its projection on plane 3 is computed.
-          */
-        Vector3d joint_line = map_it1->normal.cross(map_it2->normal);
-        joint_line = joint_line.normalized ();
-        double dis_origin2plane = -map_it3->bias;
-        double dis_endpoint2plane = joint_line.dot(map_it3->normal) - map_it3->bias;
-        Vector3d projection_origin2plane = -dis_origin2plane * map_it3->normal;
-        Vector3d projection_endpoint2plane = joint_line - dis_endpoint2plane * map_it3->normal;
-        Vector3d projection = projection_endpoint2plane - projection_origin2plane;
-        double cos_angle = projection.norm ();
-        if (cos_angle > cos_min_angle || cos_angle < cos_max_angle)
-          continue;
+void
+SegmentPairTable::compute (const PlanarSegment::StdVector &segments, double cos_min_angle, double cos_max_angle)
+{
+  size = static_cast<int> (segments.size ());
+  cos_angle.resize (size * size);
+  angle.resize (size * size);
+  non_parallel.resize (size * size);
+  for (int i = 0; i < size; i++)
+  {
+    for (int j = i; j < size; j++)
+    {
+      /** clamp the rounding errors of unit normals, acos is NaN outside [-1,1]. */
+      double c = std::max (-1.0, std::min (1.0, segments[i].normal.dot (segments[j].normal)));
+      double a = acos (c);
+      char np = (c > cos_min_angle || c < cos_max_angle) ? 0 : 1;
+      cos_angle[index (i, j)] = cos_angle[index (j, i)] = c;
+      angle[index (i, j)] = angle[index (j, i)] = a;
+      non_parallel[index (i, j)] = non_parallel[index (j, i)] = np;
+    }
+  }
+}
 
-        translation = translationFromThreeCorrespondencePairs(it1, it2, it3);
-        if (exceedLocomotionAbility(translation))
-          continue;
+bool
+Registration::deadlineReached () const
+{
+  return (params_.time_budget > 0.0 && wallTime () > deadline_);
+}
 
-        if (findRotation (solution,0.1) == false)
-          continue;
+double
+Registration::pairArea (const AreaConsistentPair &pair) const
+{
+  return ((*big_map_segments_)[pair.lhs].area * (*big_data_segments_)[pair.rhs].area);
+}
 
-        if (overlapping(*it1, solution.rotation, translation) == false)
-          continue;
-        //std::cerr << "pair 1 overlapping test: " << pair1_overlapping++ << std::endl;
-        if (overlapping(*it2, solution.rotation, translation) == false)
-          continue;
-        //std::cerr << "pair 2 overlapping test: " << pair2_overlapping++ << std::endl;
-        if (overlapping(*it3, solution.rotation, translation) == false)
-          continue;
-        //std::cerr << "pair 3 overlapping test: " << pair3_overlapping++ << std::endl;
+double
+Registration::explainedArea (const Solution &solution)
+{
+  double total_area = 0.0;
+  for (PlanarSegment::StdVector::iterator it = big_data_segments_->begin (); it != big_data_segments_->end (); it++)
+    total_area += it->area;
+  if (total_area == 0.0)
+    return (0.0);
+
+  double area = 0.0;
+  for (size_t i = 0; i < solution.correspondences.size (); i++)
+    area += (*big_data_segments_)[solution.correspondences[i].rhs].area;
+  return (area / total_area);
+}
 
-        //sort it1,it2 and it3 in order to reach a unique combination.
-        AreaConsistentPairTriplets key;
-        if (it3 > it2)
-        {
-          key.first = it1 - area_consistent_planes_->begin();
-          key.second = it2 - area_consistent_planes_->begin();
-          key.third = it3 - area_consistent_planes_->begin();
-        }
-        if (it3 < it1)
-        {
-          key.first = it3 - area_consistent_planes_->begin();
-          key.second = it1 - area_consistent_planes_->begin();
-          key.third = it2 - area_consistent_planes_->begin();
-        }
-        if (it3 > it1 && it3 < it2)
-        {
-          key.first = it1 - area_consistent_planes_->begin();
-          key.second = it3 - area_consistent_planes_->begin();
-          key.third = it2 - area_consistent_planes_->begin();
-        }
+bool
+Registration::massCenterOffsetsAgree (const AreaConsistentPair &pair1,
+                                      const AreaConsistentPair &pair2,
+                                      double chord1,
+                                      double chord2)
+{
+  const PlanarSegment &map_segment1 = (*big_map_segments_)[pair1.lhs];
+  const PlanarSegment &map_segment2 = (*big_map_segments_)[pair2.lhs];
+  const PlanarSegment &data_segment1 = (*big_data_segments_)[pair1.rhs];
+  const PlanarSegment &data_segment2 = (*big_data_segments_)[pair2.rhs];
+
+  /** both mass centers lie within the overlapping radius of their pair after the transformation. */
+  double radius = std::min (sqrt(map_segment1.area/M_PI), sqrt(data_segment1.area/M_PI)) +
+                  std::min (sqrt(map_segment2.area/M_PI), sqrt(data_segment2.area/M_PI));
+  Vector3d map_offset = map_segment2.mass_center - map_segment1.mass_center;
+  Vector3d data_offset = data_segment2.mass_center - data_segment1.mass_center;
+  double offset_norm = data_offset.norm ();
+
+  if (fabs(map_offset.dot (map_segment1.normal) - data_offset.dot (data_segment1.normal)) > radius + chord1 * offset_norm + 1e-9)
+    return false;
+  if (fabs(map_offset.dot (map_segment2.normal) - data_offset.dot (data_segment2.normal)) > radius + chord2 * offset_norm + 1e-9)
+    return false;
+  return true;
+}
 
-        if (area_consistent_pair_triplets_.find(key) == area_consistent_pair_triplets_.end ())
-        {
-          area_consistent_pair_triplets_.insert (key);
-          solution.correspondences.push_back(*it3);
-          solution.translation = translation;
-          solutions_.push_back (solution);
-        }
-      }//inner loop
-    }//second outer loop
-  }//first outer loop
+void
+AngleSignatureIndex::compute (const SegmentPairTable &relations)
+{
+  size = relations.size;
+  offsets.assign (size + 1, 0);
+  angles.clear ();
+  segments.clear ();
+  for (int i = 0; i < size; i++)
+  {
+    row.clear ();
+    for (int j = 0; j < size; j++)
+    {
+      if (relations.non_parallel[relations.index (i, j)])
+        row.push_back (std::make_pair (relations.angle[relations.index (i, j)], j));
+    }
+    std::sort (row.begin (), row.end ());
+    for (size_t k = 0; k < row.size (); k++)
+    {
+      angles.push_back (row[k].first);
+      segments.push_back (row[k].second);
+    }
+    offsets[i + 1] = static_cast<int> (angles.size ());
+  }
+}
 
-  std::cerr << solutions_.size () << " three-non-parallel pairs have been found.\n";
+void
+AngleSignatureIndex::rangeQuery (int i, double min_angle, double max_angle, std::vector<int> &result) const
+{
+  std::vector<double>::const_iterator row_begin = angles.begin () + offsets[i];
+  std::vector<double>::const_iterator row_end = angles.begin () + offsets[i + 1];
+  std::vector<double>::const_iterator first = std::lower_bound (row_begin, row_end, min_angle);
+  std::vector<double>::const_iterator last = std::upper_bound (first, row_end, max_angle);
+  for (; first != last; first++)
+    result.push_back (segments[first - angles.begin ()]);
+}
+
+void
+Registration::updateSegmentPairTables()
+{
+  /** the tables belong to the big segments, which are rebuilt from the same segments on every execute (). */
+  double cos_min_angle = cos(params_.unparallel_min_angle);
+  double cos_max_angle = cos(params_.unparallel_max_angle);
+  if (map_relations_dirty_ || map_relations_.size != static_cast<int> (big_map_segments_->size ()))
+  {
+    map_relations_.compute (*big_map_segments_, cos_min_angle, cos_max_angle);
+    map_relations_dirty_ = false;
+  }
+  if (data_relations_dirty_ || data_relations_.size != static_cast<int> (big_data_segments_->size ()))
+  {
+    data_relations_.compute (*big_data_segments_, cos_min_angle, cos_max_angle);
+    data_angle_index_.compute (data_relations_);
+    data_relations_dirty_ = false;
+  }
+}
+
+int
+Registration::numberOfThreads () const
+{
+#ifdef _OPENMP
+  return (params_.threads > 0 ? params_.threads : omp_get_max_threads ());
+#else
+  return (1);
+#endif
 }
 
 bool
@@ -927,117 +1405,237 @@ Registration::overlapping (AreaConsistentPair one_pair,
 void
 Registration::ensureUniqueMapping(Solution &solution)
 {
-  bool DEBUG = false;
-  if (DEBUG)
-  {
-    for (int i = 0; i < solution.correspondences.size(); i++)
-      std::cout << "(" << solution.correspondences[i].lhs << "," << solution.correspondences[i].rhs << ");" ;
-    std::cout << std::endl;
-  }
+  /** conflicts with more rows or columns are resolved greedily, the Hungarian method is cubic in their number. */
+  const int max_assignment_size = 200;
+  int pair_num = solution.correspondences.count;
+  if (pair_num < 2)
+    return;
+
   PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
   PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
-  std::vector<int> idx2remove;
-  idx2remove.clear();
-  std::vector<bool> key_visited;
-  key_visited.clear ();
-  key_visited.resize(solution.correspondences.size(), false);
+  AssignmentBuffers &buffers = assignment_buffers_;
+  bool conflict = markConflictingPairs (&solution.correspondences[0], pair_num, buffers);
+  std::vector<int> &rows = buffers.rows;
+  std::vector<int> &cols = buffers.cols;
+  std::vector<char> &keep = buffers.keep;
+  if (!conflict)
+    return;
 
-  for (int i = 0; i < solution.correspondences.size() - 1; i++)
+  /** dense cost matrix of the conflicts, the cost of a pair is the distance between the mass centers after the transformation.
+      A repeated pair keeps its first position, cells without a pair are marked by -1. */
+  int row_num = static_cast<int> (rows.size ());
+  int col_num = static_cast<int> (cols.size ());
+  std::vector<int> &edges = buffers.edges;
+  std::vector<double> &costs = buffers.costs;
+  edges.assign (row_num * col_num, -1);
+  costs.assign (row_num * col_num, 0.0);
+  double max_cost = 0.0;
+  for (int k = 0; k < pair_num; k++)
   {
-    if (key_visited[i] || (solution.correspondences[i].lhs == -1))
-    {
+    if (keep[k])
       continue;
-    }
-    key_visited[i] = true;
+    const AreaConsistentPair &pair = solution.correspondences[k];
+    int row = static_cast<int> (std::lower_bound (rows.begin (), rows.end (), pair.lhs) - rows.begin ());
+    int col = static_cast<int> (std::lower_bound (cols.begin (), cols.end (), pair.rhs) - cols.begin ());
+    int cell = row * col_num + col;
+    if (edges[cell] != -1)
+      continue;
+    Vector3d mass_lhs = (map_begin + pair.lhs)->mass_center;
+    Vector3d mass_rhs = solution.rotation * (data_begin + pair.rhs)->mass_center + solution.translation;
+    edges[cell] = k;
+    costs[cell] = (mass_rhs - mass_lhs).norm ();
+    max_cost = std::max (max_cost, costs[cell]);
+  }
 
-    int key_i = solution.correspondences[i].lhs;
-    for (int j = i + 1; j < solution.correspondences.size(); j++)
+  if (std::max (row_num, col_num) <= max_assignment_size)
+  {
+    /** a missing pair costs more than any assignment of real pairs, so the number of kept pairs is maximized first. */
+    double missing_cost = (std::min (row_num, col_num) + 1) * (max_cost + 1.0);
+    for (int cell = 0; cell < row_num * col_num; cell++)
     {
-      int key_j = solution.correspondences[j].lhs;
-      if (key_j != key_i)
-        continue;
-      key_visited[j] = true;
-      Vector3d mass_lhs = (map_begin + key_i)->mass_center;
-      Vector3d mass_rhs_i = (data_begin + solution.correspondences[i].rhs)->mass_center;
-      Vector3d mass_rhs_j = (data_begin + solution.correspondences[j].rhs)->mass_center;
-      double mass_dis_i = (solution.rotation * mass_rhs_i + solution.translation - mass_lhs).norm();
-      double mass_dis_j = (solution.rotation * mass_rhs_j + solution.translation - mass_lhs).norm();
-      if (mass_dis_i >= mass_dis_j)
-      {
-        solution.correspondences[i] = solution.correspondences[j];
-      }
-      solution.correspondences[j].lhs = solution.correspondences[j].rhs = -1;
-      idx2remove.push_back(j);
+      if (edges[cell] == -1)
+        costs[cell] = missing_cost;
+    }
+    solveAssignment (costs, row_num, col_num, buffers);
+    for (int row = 0; row < row_num; row++)
+    {
+      int col = buffers.row_to_col[row];
+      if (col != -1 && edges[row * col_num + col] != -1)
+        keep[edges[row * col_num + col]] = 1;
     }
   }
-
-  if (!idx2remove.empty())
+  else
   {
-    AreaConsistentPair::StdVector correspondences;
-    for (int k = 0; k < solution.correspondences.size(); k++)
+    /** greedy resolution, the pairs are taken by increasing distance and accepted if both segments are free. */
+    std::vector<std::pair<double, int> > &order = buffers.order;
+    order.clear ();
+    for (int cell = 0; cell < row_num * col_num; cell++)
+    {
+      if (edges[cell] != -1)
+        order.push_back (std::make_pair (costs[cell], cell));
+    }
+    std::sort (order.begin (), order.end ());
+    std::vector<int> &row_to_col = buffers.row_to_col;
+    std::vector<int> &col_to_row = buffers.col_to_row;
+    row_to_col.assign (row_num, -1);
+    col_to_row.assign (col_num, -1);
+    for (size_t n = 0; n < order.size (); n++)
     {
-      if (solution.correspondences[k].lhs == -1)
+      int row = order[n].second / col_num;
+      int col = order[n].second % col_num;
+      if (row_to_col[row] != -1 || col_to_row[col] != -1)
         continue;
-      correspondences.push_back(solution.correspondences[k]);
+      row_to_col[row] = col;
+      col_to_row[col] = row;
+      keep[edges[order[n].second]] = 1;
     }
-    solution.correspondences.clear ();
-    solution.correspondences = correspondences;
   }
 
-  idx2remove.clear();
-  key_visited.clear ();
-  key_visited.resize(solution.correspondences.size(), false);
+  /** the removed pairs are compacted out in place, the range shrinks. */
+  int count = 0;
+  for (int k = 0; k < pair_num; k++)
+  {
+    if (keep[k])
+      solution.correspondences[count++] = solution.correspondences[k];
+  }
+  solution.correspondences.count = count;
+}
 
-  for (int i = 0; i < solution.correspondences.size() - 1; i++)
+bool
+Registration::markConflictingPairs (const AreaConsistentPair *pairs, int pair_num, AssignmentBuffers &buffers)
+{
+  std::vector<int> &lhs_count = buffers.lhs_count;
+  std::vector<int> &rhs_count = buffers.rhs_count;
+  for (int k = 0; k < pair_num; k++)
   {
-    if (key_visited[i] || (solution.correspondences[i].rhs == -1))
-    {
-      continue;
-    }
-    key_visited[i] = true;
-    int key_i = solution.correspondences[i].rhs;
-    for (int j = i + 1; j < solution.correspondences.size(); j++)
+    if (pairs[k].lhs >= static_cast<int> (lhs_count.size ()))
+      lhs_count.resize (pairs[k].lhs + 1, 0);
+    if (pairs[k].rhs >= static_cast<int> (rhs_count.size ()))
+      rhs_count.resize (pairs[k].rhs + 1, 0);
+  }
+
+  /** both segments of every pair are counted, a conflict on one side must not hide the other side. */
+  bool conflict = false;
+  for (int k = 0; k < pair_num; k++)
+  {
+    int lhs_num = ++lhs_count[pairs[k].lhs];
+    int rhs_num = ++rhs_count[pairs[k].rhs];
+    if (lhs_num > 1 || rhs_num > 1)
+      conflict = true;
+  }
+
+  /** the conflicting pairs are the rows (map segments) and columns (data segments) of the assignment problem. */
+  std::vector<int> &rows = buffers.rows;
+  std::vector<int> &cols = buffers.cols;
+  std::vector<char> &keep = buffers.keep;
+  rows.clear ();
+  cols.clear ();
+  keep.assign (pair_num, 1);
+  if (conflict)
+  {
+    for (int k = 0; k < pair_num; k++)
     {
-      int key_j = solution.correspondences[j].rhs;
-      if (key_j != key_i)
+      if (lhs_count[pairs[k].lhs] == 1 && rhs_count[pairs[k].rhs] == 1)
         continue;
-      key_visited[j] = true;
-      Vector3d mass_rhs = (data_begin + solution.correspondences[i].rhs)->mass_center;
-      mass_rhs = solution.rotation * mass_rhs + solution.translation;
-      Vector3d mass_lhs_i = (map_begin + solution.correspondences[i].lhs)->mass_center;
-      Vector3d mass_lhs_j = (map_begin + solution.correspondences[j].lhs)->mass_center;
-      double mass_dis_i = (mass_rhs - mass_lhs_i).norm();
-      double mass_dis_j = (mass_rhs - mass_lhs_j).norm();
-      if (mass_dis_i >= mass_dis_j)
-      {
-        solution.correspondences[i] = solution.correspondences[j];
-      }
-      solution.correspondences[j].lhs = solution.correspondences[j].rhs = -1;
-      idx2remove.push_back(j);
+      keep[k] = 0;
+      rows.push_back (pairs[k].lhs);
+      cols.push_back (pairs[k].rhs);
     }
+    std::sort (rows.begin (), rows.end ());
+    rows.erase (std::unique (rows.begin (), rows.end ()), rows.end ());
+    std::sort (cols.begin (), cols.end ());
+    cols.erase (std::unique (cols.begin (), cols.end ()), cols.end ());
   }
 
-  if (!idx2remove.empty())
+  /** the counts are reset to 0 for the next solution. */
+  for (int k = 0; k < pair_num; k++)
   {
-    AreaConsistentPair::StdVector correspondences;
-    for (int k = 0; k < solution.correspondences.size(); k++)
+    lhs_count[pairs[k].lhs] = 0;
+    rhs_count[pairs[k].rhs] = 0;
+  }
+  return (conflict);
+}
+
+void
+Registration::solveAssignment (const std::vector<double> &costs, int row_num, int col_num, AssignmentBuffers &buffers)
+{
+  /** Hungarian method with potentials, O(n^2 m) for n <= m. The smaller side is assigned to the bigger one,
+      with 1-based indices and the 0th column as the free slot of the augmenting path search. */
+  bool transposed = row_num > col_num;
+  int n = transposed ? col_num : row_num;
+  int m = transposed ? row_num : col_num;
+  std::vector<double> &u = buffers.u;
+  std::vector<double> &v = buffers.v;
+  std::vector<double> &min_slack = buffers.min_slack;
+  std::vector<int> &col_to_row = buffers.col_to_row;
+  std::vector<int> &way = buffers.way;
+  std::vector<char> &used = buffers.used;
+  u.assign (n + 1, 0.0);
+  v.assign (m + 1, 0.0);
+  col_to_row.assign (m + 1, 0);
+  way.assign (m + 1, 0);
+
+  for (int i = 1; i <= n; i++)
+  {
+    col_to_row[0] = i;
+    int j0 = 0;
+    min_slack.assign (m + 1, std::numeric_limits<double>::max ());
+    used.assign (m + 1, 0);
+    do
     {
-      if (solution.correspondences[k].lhs == -1)
-        continue;
-      correspondences.push_back(solution.correspondences[k]);
-    }
-    solution.correspondences.clear ();
-    solution.correspondences = correspondences;
+      used[j0] = 1;
+      int i0 = col_to_row[j0];
+      int j1 = 0;
+      double delta = std::numeric_limits<double>::max ();
+      for (int j = 1; j <= m; j++)
+      {
+        if (used[j])
+          continue;
+        double cost = transposed ? costs[(j - 1) * col_num + (i0 - 1)] : costs[(i0 - 1) * col_num + (j - 1)];
+        double slack = cost - u[i0] - v[j];
+        if (slack < min_slack[j])
+        {
+          min_slack[j] = slack;
+          way[j] = j0;
+        }
+        if (min_slack[j] < delta)
+        {
+          delta = min_slack[j];
+          j1 = j;
+        }
+      }
+      for (int j = 0; j <= m; j++)
+      {
+        if (used[j])
+        {
+          u[col_to_row[j]] += delta;
+          v[j] -= delta;
+        }
+        else
+        {
+          min_slack[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (col_to_row[j0] != 0);
+    do
+    {
+      int j1 = way[j0];
+      col_to_row[j0] = col_to_row[j1];
+      j0 = j1;
+    } while (j0 != 0);
   }
 
-  if (DEBUG)
+  std::vector<int> &row_to_col = buffers.row_to_col;
+  row_to_col.assign (row_num, -1);
+  for (int j = 1; j <= m; j++)
   {
-    for (int i = 0; i < solution.correspondences.size(); i++)
-      std::cout << solution.correspondences[i].lhs << ", ";
-    std::cout << std::endl;
-    for (int i = 0; i < solution.correspondences.size(); i++)
-      std::cout << solution.correspondences[i].rhs << ", ";
-    std::cout << std::endl << std::endl;
+    if (col_to_row[j] == 0)
+      continue;
+    if (transposed)
+      row_to_col[j - 1] = col_to_row[j] - 1;
+    else
+      row_to_col[col_to_row[j] - 1] = j - 1;
   }
 }
 
@@ -1123,144 +1721,94 @@ Registration::mergeSurfacesOnSameInfinitePlane(double min_dot_product,
 bool
 Registration::findOptimumSolution()
 {
-  Solution solution;
-
-  PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
-  PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
-
-  AreaConsistentPair::StdVector::iterator it;
-  double total_area = 0;
-
-  /** sort the solutions by number of correspondences. */
-  for (int i = 0; i < solutions_.size() - 1; i++)
-  {
-    for (int j = i + 1; j < solutions_.size(); j++)
-    {
-      if (solutions_[i].correspondences.size () < solutions_[j].correspondences.size())
-      {
-        solution = solutions_[i];
-        solutions_[i] = solutions_[j];
-        solutions_[j] = solution;
-      }
-    }
-  }
-
-  int index = 0;
-  for (index = 0; index < solutions_.size() - 1; index++)
-  {
-    if (solutions_[index].correspondences.size() > solutions_[index+1].correspondences.size())
-    {
-      break;
-    }
-  }
-  index += 1;
+  if (solutions_.empty ())
+    return (false);
 
-  if (solutions_.size () < 10)
+  /** rank the solutions by number of correspondences, on (score, index) keys instead of the solutions. */
+  std::vector<std::pair<double, int> > &keys = solution_keys_;
+  keys.resize (solutions_.size ());
+  size_t max_size = 0;
+  for (size_t i = 0; i < solutions_.size (); i++)
   {
-    index = solutions_.size ();
+    keys[i] = std::make_pair (static_cast<double> (solutions_[i].correspondences.size ()), static_cast<int> (i));
+    max_size = std::max (max_size, solutions_[i].correspondences.size ());
   }
-  else // solutions_.size () > 10
+  size_t top_num = 0;
+  for (size_t i = 0; i < solutions_.size (); i++)
   {
-    if (index < 10)
-      index = 10;
+    if (solutions_[i].correspondences.size () == max_size)
+      top_num++;
   }
 
-  solutions_.erase (solutions_.begin () + index, solutions_.end ());
-
-  findPotentialSolutions();
-
-  for (int i = 0; i < index; i++)
+  /** all the solutions with the top number of correspondences are kept, but at least 10. */
+  size_t index = std::min (solutions_.size (), std::max (top_num, static_cast<size_t> (10)));
+  std::partial_sort (keys.begin (), keys.begin () + index, keys.end (), higherScore);
+  keepSolutions (keys, index);
+
+  /** the re-scoring is bounded by the same deadline as the hypothesis search,
+      the kept solutions are used as they are if it stops before the first one. */
+  std::vector<Solution> &kept = kept_solutions_;
+  kept = solutions_;
+  double explored_fraction = explored_fraction_;
+  findPotentialSolutions(anytimeMode ());
+  if (solutions_.empty ())
   {
-    solutions_[i].total_area = 0;
-    total_area = 0;
-    for (it = solutions_[i].correspondences.begin(); it != solutions_[i].correspondences.end(); it++)
-    {
-//      total_area += (map_begin + it->lhs)->area;
-//      total_area += (data_begin + it->rhs)->area;
-      total_area += (map_begin + it->lhs)->area * (data_begin + it->rhs)->area;
-    }
-    solutions_[i].total_area = total_area;
+    solutions_.swap (kept);
+    explored_fraction_ = explored_fraction;
   }
+  kept.clear ();
 
-  if (index > 1) // more than one solutions with same top number of correspondences
+  keys.resize (solutions_.size ());
+  for (size_t i = 0; i < solutions_.size (); i++)
   {
-    for (int i = 0; i < index - 1; i++)
-    {
-      for (int j = i + 1; j < index; j++)
-      {
-        if (solutions_[i].total_area < solutions_[j].total_area)
-        {
-          solution = solutions_[i];
-          solutions_[i] = solutions_[j];
-          solutions_[j] = solution;
-        }
-      }
-    }
+    solutions_[i].total_area = solutionArea (solutions_[i]);
+    keys[i] = std::make_pair (solutions_[i].total_area, static_cast<int> (i));
   }
+  std::sort (keys.begin (), keys.end (), higherScore);
+  keepSolutions (keys, keys.size ());
 
+  bool consistent = true;
   if (!findRotation (solutions_[0], 0.1))
   {
     std::cerr << "the difference between calculated rotation and initial rotation is bigger than the threshold.\n";
+    consistent = false;
   }
   if (!findTranslation (solutions_[0], 0.1))
   {
     std::cerr << "the difference between calculated translation and initial translation is bigger than the threshold.\n";
+    consistent = false;
   }
+  return (consistent);
 }
 
 void
 Registration::refineSolutions()
 {
-  Solution solution;
-//  bool *map_flags = new bool [big_map_segments_->size()];
-//  bool *data_flags = new bool [big_data_segments_->size()];
-
-  PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
-  PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
+  if (solutions_.empty ())
+    return;
 
-  AreaConsistentPair::StdVector::iterator it;
-  double total_area = 0;
+  size_t max_size = 0;
+  for (size_t i = 0; i < solutions_.size (); i++)
+    max_size = std::max (max_size, solutions_[i].correspondences.size ());
 
-  int index = 0;
-  for (int i = 0; i < solutions_.size() - 1 ; i++)
+  /** the solutions with the top number of correspondences are ranked by their area, the others follow in their order. */
+  std::vector<std::pair<double, int> > &keys = solution_keys_;
+  keys.clear ();
+  for (size_t i = 0; i < solutions_.size (); i++)
   {
-    if (solutions_[i].correspondences.size() > solutions_[i+1].correspondences.size())
-    {
-      index = i + 1;
-      break;
-    }
+    if (solutions_[i].correspondences.size () != max_size)
+      continue;
+    solutions_[i].total_area = solutionArea (solutions_[i]);
+    keys.push_back (std::make_pair (solutions_[i].total_area, static_cast<int> (i)));
   }
-
-  PCL_INFO ("There are %d solutions with the top number of correspondences.\n", index);
-
-  for (int i = 0; i < index; i++)
+  PCL_INFO ("There are %d solutions with the top number of correspondences.\n", keys.size ());
+  std::sort (keys.begin (), keys.end (), higherScore);
+  for (size_t i = 0; i < solutions_.size (); i++)
   {
-    solutions_[i].total_area = 0;
-    total_area = 0;
-    for (it = solutions_[i].correspondences.begin(); it != solutions_[i].correspondences.end(); it++)
-    {
-//      total_area += (map_begin + it->lhs)->area;
-//      total_area += (data_begin + it->rhs)->area;
-      total_area += (map_begin + it->lhs)->area * (data_begin + it->rhs)->area;
-    }
-    solutions_[i].total_area = total_area;
-  }
-
-  if (index > 1) // more than one solutions with same top number of correspondences
-  {
-    for (int i = 0; i < index - 1; i++)
-    {
-      for (int j = i + 1; j < index; j++)
-      {
-        if (solutions_[i].total_area < solutions_[j].total_area)
-        {
-          solution = solutions_[i];
-          solutions_[i] = solutions_[j];
-          solutions_[j] = solution;
-        }
-      }
-    }
+    if (solutions_[i].correspondences.size () != max_size)
+      keys.push_back (std::make_pair (0.0, static_cast<int> (i)));
   }
+  keepSolutions (keys, keys.size ());
 
   if (!findRotation (solutions_[0], 0.1))
   {
@@ -1272,55 +1820,148 @@ Registration::refineSolutions()
   }
 }
 
+void
+Registration::keepSolutions(const std::vector<std::pair<double, int> > &keys, size_t k)
+{
+  /** the solutions are fixed-size records, the correspondences stay in the pool. */
+  std::vector<Solution> &kept = scored_solutions_;
+  kept.resize (k);
+  for (size_t i = 0; i < k; i++)
+    kept[i] = solutions_[keys[i].second];
+  solutions_.swap (kept);
+  kept.clear ();
+}
+
+double
+Registration::solutionArea(const Solution &solution) const
+{
+  double total_area = 0.0;
+  for (size_t i = 0; i < solution.correspondences.size (); i++)
+    total_area += pairArea (solution.correspondences[i]);
+  return (total_area);
+}
+
 
 void
-Registration::point2plane(Solution solution)
+Registration::point2plane(Solution &solution)
 {
-  AreaConsistentPair::StdVector::iterator it;
+  if (params_.refine_iterations <= 0 || solution.correspondences.empty ())
+    return;
+
+  CorrespondenceRange::iterator it;
   PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
   PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
   PlanarSegment::StdVector::iterator map_it;
   PlanarSegment::StdVector::iterator data_it;
 
-  Matrix6d C = Matrix6d::Zero ();
-  Vector6d b = Vector6d::Zero ();
-  Vector3d g_ij, n_i;
-  Vector6d gn_ij;
-
+  /** gather the samples once, in equal strides over the points of every data segment. */
+  refinement_points_.clear ();
+  refinement_planes_.clear ();
   for (it = solution.correspondences.begin(); it != solution.correspondences.end(); it++)
   {
-    map_it = map_begin + it->lhs;
     data_it = data_begin + it->rhs;
-    n_i = map_it->normal;
-    for (std::vector<int>::iterator idx = data_it->points.begin(); idx != data_it->points.end(); idx++)
+    int point_num = static_cast<int> (data_it->points.size ());
+    if (point_num == 0)
+      continue;
+    int sample_num = std::min (refinementSampleNumber (*data_it), point_num);
+    double stride = static_cast<double> (point_num) / sample_num;
+    for (int k = 0; k < sample_num; k++)
     {
-      Vector3d point(data_cloud_->points[*idx].x, data_cloud_->points[*idx].y, data_cloud_->points[*idx].z);
-      point = solution.rotation * point + solution.translation;
-      g_ij = point.cross (n_i);
-      gn_ij.head<3>() = g_ij;
-      gn_ij.tail<3>() = n_i;
-      C += gn_ij * gn_ij.transpose ();
-
-      double dis = point.dot (n_i) - map_it->bias;
-      b += dis * gn_ij;
+      const pcl::PointXYZ &point = data_cloud_->points[data_it->points[static_cast<int> ((k + 0.5) * stride)]];
+      refinement_points_.push_back (Vector3d (point.x, point.y, point.z));
+      refinement_planes_.push_back (it->lhs);
     }
   }
 
-  Vector6d r = C.fullPivHouseholderQr ().solve(b);
-  assert(b.isApprox(C*r));
+  int sample_num = static_cast<int> (refinement_points_.size ());
+  int thread_num = numberOfThreads ();
+  refinement_hessians_.resize (thread_num);
+  refinement_gradients_.resize (thread_num);
+  for (int iteration = 0; iteration < params_.refine_iterations; iteration++)
+  {
+    /** the normal equations are summed per thread over static chunks, the partial sums are added in thread order
+        so the result does not depend on the scheduling. */
+    for (int i = 0; i < thread_num; i++)
+    {
+      refinement_hessians_[i].setZero ();
+      refinement_gradients_[i].setZero ();
+    }
+    const Matrix3d rotation = solution.rotation;
+    const Vector3d translation = solution.translation;
+#pragma omp parallel num_threads(thread_num)
+    {
+#ifdef _OPENMP
+      int thread = omp_get_thread_num ();
+#else
+      int thread = 0;
+#endif
+      Matrix6d C = Matrix6d::Zero ();
+      Vector6d b = Vector6d::Zero ();
+      Vector6d gn_ij;
+#pragma omp for schedule(static)
+      for (int k = 0; k < sample_num; k++)
+      {
+        const PlanarSegment &plane = *(map_begin + refinement_planes_[k]);
+        Vector3d point = rotation * refinement_points_[k] + translation;
+        gn_ij.head<3>() = point.cross (plane.normal);
+        gn_ij.tail<3>() = plane.normal;
+        C.noalias () += gn_ij * gn_ij.transpose ();
+
+        double dis = point.dot (plane.normal) - plane.bias;
+        b += dis * gn_ij;
+      }
+      refinement_hessians_[thread] = C;
+      refinement_gradients_[thread] = b;
+    }
+    Matrix6d C = Matrix6d::Zero ();
+    Vector6d b = Vector6d::Zero ();
+    for (int i = 0; i < thread_num; i++)
+    {
+      C += refinement_hessians_[i];
+      b += refinement_gradients_[i];
+    }
+
+    Vector6d r = C.fullPivHouseholderQr ().solve(b);
+    if (!r.allFinite ())
+      break;
 
-  Matrix3d rotation;
-  double cosx = cos(r(0)), sinx = sin(r(0));
-  double cosy = cos(r(1)), siny = sin(r(1));
-  double cosz = cos(r(2)), sinz = sin(r(2));
-  rotation << cosy*cosz, cosx*sinz + sinx*siny*cosz, sinx*sinz - cosx*siny*cosz,
-              -cosy*sinz, cosx*cosz - sinx*siny*sinz, sinx*cosz + cosx*siny*sinz,
-              siny, -sinx*cosy, cosx*cosy;
+    /** the euler angles of r are the negative of the rotation update, so is its translation part. */
+    Matrix3d rotation_update;
+    double cosx = cos(r(0)), sinx = sin(r(0));
+    double cosy = cos(r(1)), siny = sin(r(1));
+    double cosz = cos(r(2)), sinz = sin(r(2));
+    rotation_update << cosy*cosz, cosx*sinz + sinx*siny*cosz, sinx*sinz - cosx*siny*cosz,
+                       -cosy*sinz, cosx*cosz - sinx*siny*sinz, sinx*cosz + cosx*siny*sinz,
+                       siny, -sinx*cosy, cosx*cosy;
 
-  solution.rotation = rotation * solution.rotation;
-  solution.translation = rotation * solution.translation + r.tail<3>();
+    solution.rotation = rotation_update * solution.rotation;
+    solution.translation = rotation_update * solution.translation - r.tail<3>();
 
-//  std::cout << "eular angles and translation: " << r.transpose () << std::endl;
+    /** converged once the update is below a micro radian and a micro meter. */
+    if (r.head<3>().cwiseAbs().maxCoeff() < 1e-6 && r.tail<3>().cwiseAbs().maxCoeff() < 1e-6)
+      break;
+  }
+}
+
+int
+Registration::refinementSampleNumber (const PlanarSegment &segment) const
+{
+  /** at least as many samples as the refinement has degrees of freedom. */
+  const int min_sample_num = 6;
+  int point_num = static_cast<int> (segment.points.size ());
+  if (params_.refine_tolerance <= 0.0 || point_num <= min_sample_num)
+    return (point_num);
+
+  /** the offset variance of the full segment is N times smaller than the one of a single point,
+      n samples give the variance N * offset_variance / n. */
+  double offset_variance = segment.covariance(3,3);
+  if (offset_variance <= 0.0)
+  {
+    SelfAdjointEigenSolver<Matrix3d> eigensolver (segment.scatter_matrix, EigenvaluesOnly);
+    offset_variance = eigensolver.eigenvalues ()(0) / (static_cast<double> (point_num) * point_num);
+  }
+  double sample_num = ceil (point_num * offset_variance / (params_.refine_tolerance * params_.refine_tolerance));
+  return (static_cast<int> (std::max (static_cast<double> (min_sample_num), std::min (sample_num, static_cast<double> (point_num)))));
 }
 
 
@@ -1525,6 +2166,7 @@ void
 Registration::setMapSegments(PlanarSegment::StdVectorPtr segments)
 {
   map_segments_ = segments;
+  map_relations_dirty_ = true;
 }
 
 
@@ -1548,6 +2190,7 @@ Registration::setMapSegments(std::string segments_file)
     it ++;
   }
   infile.close ();
+  map_relations_dirty_ = true;
   PCL_INFO ("%d raw map segments loaded.\n", map_segments_->size());
 }
 
@@ -1555,6 +2198,7 @@ void
 Registration::setDataSegments(PlanarSegment::StdVectorPtr segments)
 {
   data_segments_ = segments;
+  data_relations_dirty_ = true;
 }
 
 
@@ -1578,13 +2222,29 @@ Registration::setDataSegments(std::string segments_file)
     it ++;
   }
   infile.close ();
+  data_relations_dirty_ = true;
   PCL_INFO ("%d raw data segments loaded.\n", data_segments_->size());
 }
 
+void
+Registration::dataAsMap()
+{
+  map_cloud_.swap (data_cloud_);
+  map_segments_.swap (data_segments_);
+  map_relations_.swap (data_relations_);
+  map_relations_dirty_ = data_relations_dirty_;
+  data_relations_dirty_ = true;
+}
+
 
 void
 Registration::visualizeCorrespondences()
 {
+  if (solutions_.empty ())
+  {
+    PCL_WARN ("No solution to visualize.\n");
+    return;
+  }
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr map_vis(new pcl::PointCloud<pcl::PointXYZRGB>);
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr data_vis(new pcl::PointCloud<pcl::PointXYZRGB>);
   map_vis->resize(map_cloud_->size());
@@ -1592,7 +2252,7 @@ Registration::visualizeCorrespondences()
 
   std::vector<RGB> colors;
   getColors(colors);
-  AreaConsistentPair::StdVector::iterator it;
+  CorrespondenceRange::iterator it;
   PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
   PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
   PlanarSegment::StdVector::iterator map_it;
@@ -1692,14 +2352,20 @@ Registration::visualizeCorrespondences()
 
 void
 Registration::visualizeCorrespondencesWithPoints()
-{  pcl::PointCloud<pcl::PointXYZRGB>::Ptr map_vis(new pcl::PointCloud<pcl::PointXYZRGB>);
+{
+   if (solutions_.empty ())
+   {
+     PCL_WARN ("No solution to visualize.\n");
+     return;
+   }
+   pcl::PointCloud<pcl::PointXYZRGB>::Ptr map_vis(new pcl::PointCloud<pcl::PointXYZRGB>);
    pcl::PointCloud<pcl::PointXYZRGB>::Ptr data_vis(new pcl::PointCloud<pcl::PointXYZRGB>);
    map_vis->resize(map_cloud_->size());
    data_vis->resize(transformed_data_cloud_->size());
 
    std::vector<RGB> colors;
    getColors(colors);
-   AreaConsistentPair::StdVector::iterator it;
+   CorrespondenceRange::iterator it;
    PlanarSegment::StdVector::iterator map_begin = big_map_segments_->begin();
    PlanarSegment::StdVector::iterator data_begin = big_data_segments_->begin();
    PlanarSegment::StdVector::iterator map_it;
@@ -1795,23 +2461,7 @@ Registration::rotatePointcloud(pcl::PointCloud<pcl::PointXYZ>::Ptr input,
                                pcl::PointCloud<pcl::PointXYZ>::Ptr output,
                                Matrix3d rotation)
 {
-  double rm[9];
-  rm[0] = rotation(0,0);
-  rm[1] = rotation(0,1);
-  rm[2] = rotation(0,2);
-  rm[3] = rotation(1,0);
-  rm[4] = rotation(1,1);
-  rm[5] = rotation(1,2);
-  rm[6] = rotation(2,0);
-  rm[7] = rotation(2,1);
-  rm[8] = rotation(2,2);
-  output->resize(input->size());
-  for (size_t i = 0; i < input->size(); i++)
-  {
-    output->points[i].x = rm[0] * input->points[i].x + rm[1] * input->points[i].y + rm[2] * input->points[i].z;
-    output->points[i].y = rm[3] * input->points[i].x + rm[4] * input->points[i].y + rm[5] * input->points[i].z;
-    output->points[i].z = rm[6] * input->points[i].x + rm[7] * input->points[i].y + rm[8] * input->points[i].z;
-  }
+  tams::transformPointcloud (*input, *output, rotation.cast<float> ());
 }
 
 
@@ -1821,25 +2471,5 @@ Registration::transformPointcloud(PointCloudPtr input,
                                   Matrix3d rotation,
                                   Vector3d trans)
 {
-  double rm[9];
-  double translation[3];
-  rm[0] = rotation(0,0);
-  rm[1] = rotation(0,1);
-  rm[2] = rotation(0,2);
-  rm[3] = rotation(1,0);
-  rm[4] = rotation(1,1);
-  rm[5] = rotation(1,2);
-  rm[6] = rotation(2,0);
-  rm[7] = rotation(2,1);
-  rm[8] = rotation(2,2);
-  translation[0] = trans(0);
-  translation[1] = trans(1);
-  translation[2] = trans(2);
-  output->resize(input->size());
-  for (size_t i = 0; i < input->size(); i++)
-  {
-    output->points[i].x = rm[0] * input->points[i].x + rm[1] * input->points[i].y + rm[2] * input->points[i].z + translation[0];
-    output->points[i].y = rm[3] * input->points[i].x + rm[4] * input->points[i].y + rm[5] * input->points[i].z + translation[1];
-    output->points[i].z = rm[6] * input->points[i].x + rm[7] * input->points[i].y + rm[8] * input->points[i].z + translation[2];
-  }
+  tams::transformPointcloud (*input, *output, rotation.cast<float> (), trans.cast<float> ());
 }
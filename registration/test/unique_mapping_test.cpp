@@ -0,0 +1,99 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+#include <stdio.h>
+#include "registration/registration.h"
+
+/** Regression test of the conflict detection and resolution of Registration::ensureUniqueMapping.
+    With the pairs (1,5), (1,6) and (2,6), the second pair shares the map segment 1 with the first one and the
+    data segment 6 with the third one, so all three are in conflict, and only (1,5) and (2,6) can be kept together. */
+int
+main ()
+{
+  using namespace tams;
+  int failures = 0;
+  AreaConsistentPair pairs[3] = {AreaConsistentPair (1, 5), AreaConsistentPair (1, 6), AreaConsistentPair (2, 6)};
+  AssignmentBuffers buffers;
+
+  if (!Registration::markConflictingPairs (pairs, 3, buffers))
+  {
+    printf ("no conflict found\n");
+    failures++;
+  }
+  for (int k = 0; k < 3; k++)
+  {
+    if (buffers.keep[k])
+    {
+      printf ("pair (%d,%d) is not marked as conflicting\n", pairs[k].lhs, pairs[k].rhs);
+      failures++;
+    }
+  }
+  if (buffers.rows.size () != 2 || buffers.rows[0] != 1 || buffers.rows[1] != 2 ||
+      buffers.cols.size () != 2 || buffers.cols[0] != 5 || buffers.cols[1] != 6)
+  {
+    printf ("wrong rows or columns of the assignment problem\n");
+    failures++;
+  }
+
+  /** costs as built by ensureUniqueMapping, the missing pair (2,5) costs more than any assignment of real pairs. */
+  double missing_cost = (2 + 1) * (1.0 + 1.0);
+  std::vector<double> costs (4);
+  costs[0] = 1.0;
+  costs[1] = 0.5;
+  costs[2] = missing_cost;
+  costs[3] = 1.0;
+  Registration::solveAssignment (costs, 2, 2, buffers);
+  if (buffers.row_to_col[0] != 0 || buffers.row_to_col[1] != 1)
+  {
+    printf ("the assignment does not keep (1,5) and (2,6)\n");
+    failures++;
+  }
+
+  /** the counts are reset, the two kept pairs are free of conflicts. */
+  AreaConsistentPair kept[2] = {pairs[0], pairs[2]};
+  if (Registration::markConflictingPairs (kept, 2, buffers) || !buffers.keep[0] || !buffers.keep[1])
+  {
+    printf ("the unique pairs (1,5) and (2,6) are marked as conflicting\n");
+    failures++;
+  }
+
+  if (failures == 0)
+    printf ("unique mapping test passed\n");
+  return (failures == 0 ? 0 : 1);
+}
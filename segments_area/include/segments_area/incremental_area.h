@@ -0,0 +1,155 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+#ifndef INCREMENTAL_AREA_H_
+#define INCREMENTAL_AREA_H_
+
+//STL
+#include <vector>
+#include <stdint.h>
+//Eigen
+#include <Eigen/Core>
+//PCL
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+//boost
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+//tams
+#include "common/planar_patch.h"
+
+namespace tams
+{
+  /** \brief Area of a growing planar segment, e.g. a plane of a map which is extended by every registered scan.
+    * The plane is rasterized in its local frame into a sparse hash of 8x8 cell blocks, one bit per cell. Adding
+    * points only touches the cells of the new points, so the cost of an update is proportional to the number of
+    * points added and not to the size of the plane. The cell size should be about the point spacing of the sensor
+    * on the plane, smaller cells leave gaps between the scan lines, larger ones overestimate the area along the border.
+    */
+  class IncrementalArea
+  {
+    public:
+      typedef boost::shared_ptr<IncrementalArea> Ptr;
+      typedef std::vector<IncrementalArea, Eigen::aligned_allocator<IncrementalArea> > StdVector;
+
+      /** \brief Constructor.
+        * \param[in] cell_size edge length of a raster cell in meter
+        */
+      IncrementalArea (double cell_size = 0.05);
+
+      /** \brief Set the local frame of the plane, the in-plane axes are chosen perpendicular to the normal.
+        * Clears the raster.
+        * \param[in] normal the plane normal
+        * \param[in] origin a point on the plane, typically the mass center of the first segment
+        */
+      void
+      setPlane (const Eigen::Vector3d &normal, const Eigen::Vector3d &origin);
+
+      /** \brief Add the points of a segment, the plane is initialized from the first segment if not set.
+        * \param[in] segment the planar segment, its attributes are in the frame of cloud
+        * \param[in] cloud the point cloud of the segment
+        * \param[in] rotation rotation from the frame of cloud to the frame of the plane
+        * \param[in] translation translation from the frame of cloud to the frame of the plane
+        */
+      void
+      addSegment (const PlanarSegment &segment, const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                  const Eigen::Matrix3d &rotation = Eigen::Matrix3d::Identity (),
+                  const Eigen::Vector3d &translation = Eigen::Vector3d::Zero ());
+
+      /** \brief Add points to the plane.
+        * \param[in] cloud the point cloud
+        * \param[in] indices indices of the points to be added
+        * \param[in] rotation rotation from the frame of cloud to the frame of the plane
+        * \param[in] translation translation from the frame of cloud to the frame of the plane
+        * \return the number of newly occupied cells
+        */
+      int
+      addPoints (const pcl::PointCloud<pcl::PointXYZ> &cloud, const std::vector<int> &indices,
+                 const Eigen::Matrix3d &rotation = Eigen::Matrix3d::Identity (),
+                 const Eigen::Vector3d &translation = Eigen::Vector3d::Zero ());
+
+      /** \brief Remove all cells, the plane is kept. */
+      void
+      clear ();
+
+      /** \brief Get the area covered by the occupied cells. */
+      inline double
+      area () const
+      {
+        return (static_cast<double> (occupied_cells_) * cell_size_ * cell_size_);
+      }
+
+      /** \brief Get the number of occupied cells. */
+      inline long
+      occupiedCells () const
+      {
+        return (occupied_cells_);
+      }
+
+      /** \brief Get the edge length of a raster cell. */
+      inline double
+      cellSize () const
+      {
+        return (cell_size_);
+      }
+
+    private:
+      /** \brief Floor division by the block size 8 which also works for negative cell indices. */
+      static inline int
+      blockIndex (int cell)
+      {
+        return (cell >= 0 ? cell / 8 : -((-cell + 7) / 8));
+      }
+
+    private:
+      /** \brief 8x8 cells per block, bit (x + 8 * y) for cell (x, y) of the block. */
+      boost::unordered_map<uint64_t, uint64_t> blocks_;
+      /** \brief Rows are the in-plane axes and the normal. */
+      Eigen::Matrix3d plane_rotation_;
+      Eigen::Vector3d plane_origin_;
+      double cell_size_;
+      long occupied_cells_;
+      bool plane_set_;
+
+    public:
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+}
+
+#endif
@@ -42,6 +42,7 @@
 
 //STL
 #include <vector>
+#include <stdint.h>
 //PCL
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -54,6 +55,7 @@
 #include <CGAL/Alpha_shape_2.h>
 #include <CGAL/Alpha_shape_vertex_base_2.h>
 #include <CGAL/Alpha_shape_face_base_2.h>
+#include <CGAL/convex_hull_2.h>
 //boost
 #include <boost/shared_ptr.hpp>
 //tams
@@ -64,7 +66,7 @@ namespace tams
 {
   /** \brief This class is used to calculate the area of each planar segment resulted from plane segmentation of a 3D point cloud.
     * Four methods are provides, namely, surface integrals inspired (proposed by us), Delaunay triangulation based, Alpha-shapes based,
-    * and the number of square units (see )*/
+    * and the number of square units (see ). A fast occupancy grid estimator is provided in addition for unorganized clouds.*/
   /** \todo add references. */
   class SegmentsArea
   {
@@ -77,15 +79,26 @@ namespace tams
       typedef CGAL::Alpha_shape_2<Delaunay> Alpha_shape_2;
 
     public:
-      enum AreaCalculationMethod {SumOfSmallFaces, DelaunayTriangulation, AlphaShape, NumberOfSquareUnits};
+      enum AreaCalculationMethod {SumOfSmallFaces, DelaunayTriangulation, AlphaShape, NumberOfSquareUnits, OccupancyGrid};
+
+      /** \brief Areas of the interior and of all occupied cells of a segment, computed by areaByOccupancyGrid.
+        * They usually enclose the alpha-shape area, but they do not bound it: the alpha shape bridges the empty cells
+        * of holes, concave corners and sparse scan lines.
+        */
+      struct AreaEstimate
+      {
+        double interior;
+        double occupied;
+        AreaEstimate () : interior (0.0), occupied (0.0) {}
+      };
 
       /** \brief Empty constructor. */
       SegmentsArea();
       /** \brief Constructor with point cloud, segments, method and sensor resolution.
         * \param[in] cloud boost shared pointer to the corresponding point cloud
         * \param[in] planar segments from a plane segmentation of cloud
-        * \param[in] the method to use, four methods have been provided, namely
-        *            SumOfSmallFaces, DelaunayTriangulation, AlphaShape, and NumberOfSquareUnits.
+        * \param[in] the method to use, five methods have been provided, namely
+        *            SumOfSmallFaces, DelaunayTriangulation, AlphaShape, NumberOfSquareUnits and OccupancyGrid.
         * \param[in] vertical_resolution vertical resolution of the scanner wich was used to scan the given cloud
         * \param[in] horizontal_resolution horizontal resolution of the scanner wich was used to scan the given cloud
         */
@@ -116,6 +129,18 @@ namespace tams
       void
       areaByAlphaShape(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments);
 
+      /** \brief Calculate the alpha-shape area only for segments which may be bigger than min_area.
+        * The occupancy grid estimator is run first. The alpha shape is made of Delaunay triangles, so the area of the
+        * convex hull bounds it; segments whose occupied cells and convex hull are both below min_area keep the smaller
+        * of the two areas.
+        * Useful in front of Registration::getBigSegments(double min_area), requires the sensor resolution.
+        * \param[in] cloud boost shared pointer to the corresponding point cloud.
+        * \param[in] segments planar segments from a plane segmentation result of cloud
+        * \param[in] min_area segments smaller than this are not evaluated by the alpha shape
+        */
+      void
+      areaByAlphaShape(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments, double min_area);
+
       /** \brief Calculate the surface area by counting the number of square units in the segment.
         * \param[in] cloud boost shared pointer to the corresponding point cloud.
         * \param[in] segments planar segments from a plane segmentation result of cloud
@@ -123,27 +148,146 @@ namespace tams
       void
       areaByNumberOfSquareUnits(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments);
 
-    private:
-      /** \brief Transfer pcl::PointXYZ to Eigen::vector3d which is easy for computation.
+      /** \brief Estimate the surface area by rasterizing each segment into a bit-packed occupancy grid on its plane.
+        * The cell size follows the point spacing of the sensor at the range and incidence angle of the segment.
+        * The estimate lies halfway between the area of the interior cells and the one of all occupied cells, which are
+        * available from getAreaEstimates ().
         * \param[in] cloud boost shared pointer to the corresponding point cloud.
+        * \param[in] segments planar segments from a plane segmentation result of cloud
+        * \param[in] closing fill the gaps between scan lines by a 3x3 morphological closing
         */
       void
-      toEigenTypes(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud);
+      areaByOccupancyGrid(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments,
+                          bool closing = true);
+
+      /** \brief Get the cell areas of the last call to areaByOccupancyGrid, one per segment. */
+      inline const std::vector<AreaEstimate>&
+      getAreaEstimates () const
+      {
+        return (area_estimates_);
+      }
+
+      /** \brief Set the number of threads used by the area calculation.
+        * \param[in] number_of_threads the number of threads, 0 means the OpenMP default.
+        */
+      inline void
+      setNumberOfThreads (int number_of_threads)
+      {
+        number_of_threads_ = number_of_threads;
+      }
+
+      /** \brief Set the sensor resolution, needed by NumberOfSquareUnits and OccupancyGrid.
+        * \param[in] vertical_resolution vertical resolution of the scanner in degrees
+        * \param[in] horizontal_resolution horizontal resolution of the scanner in degrees
+        */
+      inline void
+      setSensorResolution (double vertical_resolution, double horizontal_resolution)
+      {
+        vertical_resolution_ = vertical_resolution;
+        horizontal_resolution_ = horizontal_resolution;
+      }
+
+      /** \brief Whether to print and log the calculation time. */
+      inline void
+      setVerbose (bool verbose)
+      {
+        verbose_ = verbose;
+      }
+
+    private:
+      /** \brief Get the number of threads actually used, 1 if OpenMP is not available. */
+      int
+      numberOfThreads () const;
+
+      /** \brief Accumulate the cross products of the small faces anchored at one pixel.
+        * \param[in] x, y, z the coordinate planes of the organized cloud
+        * \param[in] labels the label image, -1 for points not belonging to any segment
+        * \param[in] width the width of the organized cloud
+        * \param[in] index the index of the anchor pixel
+        * \param[out] sums the cross product accumulators, three per segment
+        */
+      static void
+      sumOfSmallFacesPixel (const float *x, const float *y, const float *z, const int *labels,
+                            int width, int index, double *sums);
+
+      /** \brief Accumulate the cross products of the small faces anchored at four consecutive pixels using SSE2.
+        * See sumOfSmallFacesPixel for the parameters.
+        */
+      static void
+      sumOfSmallFacesBlock (const float *x, const float *y, const float *z, const int *labels,
+                            int width, int index, double *sums);
+
+      /** \brief Calculate the alpha-shape area of one segment.
+        * \param[in] cloud the corresponding point cloud
+        * \param[in] segment the planar segment
+        * \param[out] cgal_points buffer for the projected points
+        */
+      double
+      alphaShapeArea (const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                      std::vector<CGALPoint2> &cgal_points);
+
+      /** \brief Calculate the area of the convex hull of one segment, an upper bound of its alpha-shape area.
+        * \param[in] cloud the corresponding point cloud
+        * \param[in] segment the planar segment
+        * \param[out] cgal_points buffer for the projected points
+        * \param[out] hull buffer for the vertices of the hull
+        */
+      double
+      convexHullArea (const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                      std::vector<CGALPoint2> &cgal_points, std::vector<CGALPoint2> &hull);
+
+      /** \brief Get the rotation which aligns the surface normal of a segment to the z-axis.
+        * The first two rows span the plane, the first one along the largest extent of the segment.
+        */
+      static Eigen::Matrix3d
+      planeBasis (const PlanarSegment &segment);
+
+      /** \brief 3x3 dilation or erosion of a bit-packed grid, cells outside the grid are empty.
+        * \param[in] in the grid, rows of words 64 bit integers
+        * \param[in] rows the number of rows
+        * \param[in] words the number of 64 bit integers per row
+        * \param[in] dilate dilation if true, erosion otherwise
+        * \param[out] out the resulted grid
+        */
+      static void
+      morphology3x3 (const std::vector<uint64_t> &in, int rows, int words, bool dilate, std::vector<uint64_t> &out);
+
+      /** \brief Read a point of the borrowed cloud as Eigen::Vector3d, the cloud is never copied.
+        * \param[in] cloud the corresponding point cloud
+        * \param[in] index the index of the point
+        */
+      static inline Eigen::Vector3d
+      point (const pcl::PointCloud<pcl::PointXYZ> &cloud, int index)
+      {
+        const pcl::PointXYZ &p = cloud.points[index];
+        return (Eigen::Vector3d (p.x, p.y, p.z));
+      }
 
       /** \brief Project the points from spatial coordinates (3D) to a planar coordinates (2D).
         * The segment is rotated after what its surface normal is aligned to z-axis.
         * The translation is not considered here, since the z-coordinate will be omitted.
+        * \param[in] cloud the corresponding point cloud
         * \param[in] segment a planar segment which will be projected to a planar coordinate.
         * \param[out] cgal_points the resulted 2D points in the CGAL data format
         */
       void
-      projectSegmentTo2D(PlanarSegment segment, std::vector<CGALPoint2> &cgal_points);
+      projectSegmentTo2D(const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                         std::vector<CGALPoint2> &cgal_points);
 
     private:
-      std::vector <Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > points_;
       double vertical_resolution_;
       double horizontal_resolution_;
       bool verbose_;
+      int number_of_threads_;
+      /** \brief Label image and float coordinate planes (SoA) for the organized methods. */
+      std::vector<int> label_image_;
+      std::vector<float> x_plane_;
+      std::vector<float> y_plane_;
+      std::vector<float> z_plane_;
+      /** \brief Occupancy grids of areaByOccupancyGrid and the resulted cell areas. */
+      std::vector<uint64_t> grid_;
+      std::vector<uint64_t> grid_tmp_;
+      std::vector<AreaEstimate> area_estimates_;
   };
 }
 
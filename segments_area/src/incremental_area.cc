@@ -0,0 +1,119 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+//STL
+#include <cmath>
+//Eigen
+#include <Eigen/Geometry>
+//tams
+#include "segments_area/incremental_area.h"
+
+namespace tams
+{
+  IncrementalArea::IncrementalArea (double cell_size)
+    : blocks_ (), plane_rotation_ (Eigen::Matrix3d::Identity ()), plane_origin_ (Eigen::Vector3d::Zero ()),
+      cell_size_ (cell_size), occupied_cells_ (0), plane_set_ (false)
+  {
+
+  }
+
+  void
+  IncrementalArea::setPlane (const Eigen::Vector3d &normal, const Eigen::Vector3d &origin)
+  {
+    Eigen::Vector3d n = normal.normalized ();
+    Eigen::Vector3d helper = fabs (n(0)) < 0.9 ? Eigen::Vector3d::UnitX () : Eigen::Vector3d::UnitY ();
+    Eigen::Vector3d axis_u = n.cross (helper).normalized ();
+    plane_rotation_.row (0) = axis_u;
+    plane_rotation_.row (1) = n.cross (axis_u);
+    plane_rotation_.row (2) = n;
+    plane_origin_ = origin;
+    plane_set_ = true;
+    clear ();
+  }
+
+  void
+  IncrementalArea::addSegment (const PlanarSegment &segment, const pcl::PointCloud<pcl::PointXYZ> &cloud,
+                               const Eigen::Matrix3d &rotation, const Eigen::Vector3d &translation)
+  {
+    if (!plane_set_)
+      setPlane (rotation * segment.normal, rotation * segment.mass_center + translation);
+    addPoints (cloud, segment.points, rotation, translation);
+  }
+
+  int
+  IncrementalArea::addPoints (const pcl::PointCloud<pcl::PointXYZ> &cloud, const std::vector<int> &indices,
+                              const Eigen::Matrix3d &rotation, const Eigen::Vector3d &translation)
+  {
+    /// fold the transformation and the projection into one affine map to the plane coordinates
+    const Eigen::Matrix<double, 2, 3> projection = plane_rotation_.topRows<2> () * rotation;
+    const Eigen::Vector2d offset = plane_rotation_.topRows<2> () * (translation - plane_origin_);
+    const double inverse_cell_size = 1.0 / cell_size_;
+
+    int new_cells = 0;
+    for (std::vector<int>::const_iterator it = indices.begin (); it != indices.end (); it++)
+    {
+      const pcl::PointXYZ &p = cloud.points[*it];
+      if (std::isnan (p.x) || std::isnan (p.y) || std::isnan (p.z))
+        continue;
+      const Eigen::Vector2d uv = projection * Eigen::Vector3d (p.x, p.y, p.z) + offset;
+      const int cell_u = static_cast<int> (floor (uv(0) * inverse_cell_size));
+      const int cell_v = static_cast<int> (floor (uv(1) * inverse_cell_size));
+      const int block_u = blockIndex (cell_u);
+      const int block_v = blockIndex (cell_v);
+      const uint64_t key = (static_cast<uint64_t> (static_cast<uint32_t> (block_u)) << 32) |
+                           static_cast<uint32_t> (block_v);
+      const uint64_t bit = static_cast<uint64_t> (1) << ((cell_u - 8 * block_u) + 8 * (cell_v - 8 * block_v));
+      uint64_t &block = blocks_[key];
+      if (!(block & bit))
+      {
+        block |= bit;
+        new_cells ++;
+      }
+    }
+    occupied_cells_ += new_cells;
+    return (new_cells);
+  }
+
+  void
+  IncrementalArea::clear ()
+  {
+    blocks_.clear ();
+    occupied_cells_ = 0;
+  }
+}
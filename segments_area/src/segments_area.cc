@@ -43,13 +43,49 @@
 //STL
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <algorithm>
+#include <iterator>
 #include <sys/time.h>
+//OpenMP
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+//SSE
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 //tams
 #include "segments_area/segments_area.h"
 
+namespace
+{
+  /** \brief Add the cross product a x b to (sx, sy, sz). */
+  inline void
+  crossAdd (float ax, float ay, float az, float bx, float by, float bz, float &sx, float &sy, float &sz)
+  {
+    sx += ay * bz - az * by;
+    sy += az * bx - ax * bz;
+    sz += ax * by - ay * bx;
+  }
+
+#if defined(__SSE2__)
+  /** \brief Add the cross products a x b of four lanes to (sx, sy, sz), lanes outside of mask are skipped. */
+  inline void
+  crossAdd (__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz, __m128 mask,
+            __m128 &sx, __m128 &sy, __m128 &sz)
+  {
+    sx = _mm_add_ps (sx, _mm_and_ps (mask, _mm_sub_ps (_mm_mul_ps (ay, bz), _mm_mul_ps (az, by))));
+    sy = _mm_add_ps (sy, _mm_and_ps (mask, _mm_sub_ps (_mm_mul_ps (az, bx), _mm_mul_ps (ax, bz))));
+    sz = _mm_add_ps (sz, _mm_and_ps (mask, _mm_sub_ps (_mm_mul_ps (ax, by), _mm_mul_ps (ay, bx))));
+  }
+#endif
+}
+
 namespace tams
 {
   SegmentsArea::SegmentsArea()
+    : vertical_resolution_ (0.0), horizontal_resolution_ (0.0), verbose_ (false), number_of_threads_ (0)
   {
 
   }
@@ -60,11 +96,11 @@ namespace tams
                              AreaCalculationMethod method,
                              double vertical_resolution,
                              double horizontal_resolution)
+    : number_of_threads_ (0)
   {
     verbose_ = true;
     vertical_resolution_ = vertical_resolution;
     horizontal_resolution_ = horizontal_resolution;
-    toEigenTypes (cloud);
     switch (method)
     {
       case SumOfSmallFaces:
@@ -84,8 +120,11 @@ namespace tams
         }
         areaByNumberOfSquareUnits (cloud, segments);
         break;
+      case OccupancyGrid:
+        areaByOccupancyGrid (cloud, segments);
+        break;
       default:
-        std::cerr << "please choose a method from SumOfSmallFaces, DelaunayTriangulation, AlphaShape, NumberOfSquareUnits. \n";
+        std::cerr << "please choose a method from SumOfSmallFaces, DelaunayTriangulation, AlphaShape, NumberOfSquareUnits, OccupancyGrid. \n";
         break;
     }
   }
@@ -109,71 +148,68 @@ namespace tams
       gettimeofday(&tpstart,NULL);
     }
 
-    int height = cloud->height;
-    int width = cloud->width;
-    std::vector<Eigen::Vector3d, aligned_allocator<Eigen::Vector3d> > cross_products;
-    cross_products.resize(segments->size(), Eigen::Vector3d::Zero());
-    int *flags = new int [width * height];
-    memset(flags, 9999, width * height * sizeof(int));
+    const int height = cloud->height;
+    const int width = cloud->width;
+    const int segment_num = static_cast<int> (segments->size ());
+    if (segment_num == 0 || cloud->empty ())
+      return;
+
+    /// label image and coordinate planes, the memory is kept between calls. Only the labeled pixels
+    /// are written, the kernel masks out everything else, so unlabeled points are never touched.
+    label_image_.assign (cloud->size (), -1);
+    x_plane_.resize (cloud->size ());
+    y_plane_.resize (cloud->size ());
+    z_plane_.resize (cloud->size ());
     for (PlanarSegment::StdVector::iterator it = segments->begin(); it != segments->end(); it++)
     {
       for (std::vector<int>::iterator sub_it = it->points.begin(); sub_it != it->points.end (); sub_it++)
       {
-        flags[*sub_it] = it - segments->begin();
+        label_image_[*sub_it] = static_cast<int> (it - segments->begin());
+        x_plane_[*sub_it] = cloud->points[*sub_it].x;
+        y_plane_[*sub_it] = cloud->points[*sub_it].y;
+        z_plane_[*sub_it] = cloud->points[*sub_it].z;
       }
     }
-    int index = 0;
-    int flag = -1;
 
-    for (size_t i = 1; i < height -1; i++)
+    /// each thread sums the cross products of its row band into its own accumulators
+    const int thread_num = numberOfThreads ();
+    std::vector<double> partial_sums (thread_num * segment_num * 3, 0.0);
+    const float *x = &x_plane_[0];
+    const float *y = &y_plane_[0];
+    const float *z = &z_plane_[0];
+    const int *labels = &label_image_[0];
+
+#pragma omp parallel num_threads(thread_num)
     {
-      for (size_t j = 1; j < width -1; j++)
+#ifdef _OPENMP
+      double *sums = &partial_sums[0] + omp_get_thread_num () * segment_num * 3;
+#else
+      double *sums = &partial_sums[0];
+#endif
+#pragma omp for schedule(static)
+      for (int i = 1; i < height - 1; i++)
       {
-        index = i * width + j;
-        flag = flags[index];
-        if (flag < 9999)
-        {
-          int key = (flags[index + width] == flag) * 4 + (flags[index + width + 1] == flag) * 2 + (flags[index + 1] == flag);
-          switch (key)
-          {
-            case 7:
-              cross_products[flag] += points_[index].cross(points_[index + width]) +
-                  points_[index + width].cross(points_[index + width + 1]) +
-                  points_[index + width + 1].cross(points_[index + 1]) +
-                  points_[index + 1].cross(points_[index]);
-              break;
-            case 3:
-              cross_products[flag] += points_[index].cross(points_[index + width + 1]) +
-                  points_[index + width + 1].cross(points_[index + 1]) +
-                  points_[index + 1].cross(points_[index]);
-              break;
-            case 5:
-              cross_products[flag] += points_[index].cross(points_[index + width]) +
-                  points_[index + width].cross(points_[index + 1]) +
-                  points_[index + 1].cross(points_[index]);
-              break;
-            case 6:
-              cross_products[flag] += points_[index].cross(points_[index + width]) +
-                  points_[index + width].cross(points_[index + width + 1]) +
-                  points_[index + width + 1].cross(points_[index]);
-              break;
-            default:
-              break;
-          }
-          if ((flags[index - width - 1] != flag) && (flags[index - 1] == flag) && (flags[index - width] == flag))
-          {
-            cross_products[flag] += points_[index].cross(points_[index - width]) +
-                points_[index - width].cross(points_[index - 1]) +
-                points_[index - 1].cross(points_[index]);
-          }
-        }
+        int j = 1;
+#if defined(__SSE2__)
+        for (; j + 4 <= width - 1; j += 4)
+          sumOfSmallFacesBlock (x, y, z, labels, width, i * width + j, sums);
+#endif
+        for (; j < width - 1; j++)
+          sumOfSmallFacesPixel (x, y, z, labels, width, i * width + j, sums);
       }
     }
+
     for (PlanarSegment::StdVector::iterator it = segments->begin (); it != segments->end(); it++)
     {
-      it->area = 0.5 * fabs(it->normal.dot(cross_products[it - segments->begin ()]));
+      const int flag = static_cast<int> (it - segments->begin ());
+      Eigen::Vector3d cross_product = Eigen::Vector3d::Zero ();
+      for (int t = 0; t < thread_num; t++)
+      {
+        const double *sums = &partial_sums[(t * segment_num + flag) * 3];
+        cross_product += Eigen::Vector3d (sums[0], sums[1], sums[2]);
+      }
+      it->area = 0.5 * fabs(it->normal.dot(cross_product));
     }
-    delete [] flags;
 
     //stop the timer
     if (verbose_)
@@ -187,6 +223,101 @@ namespace tams
     }
   }
 
+  void
+  SegmentsArea::sumOfSmallFacesPixel (const float *x, const float *y, const float *z, const int *labels,
+                                      int width, int index, double *sums)
+  {
+    const int flag = labels[index];
+    if (flag < 0)
+      return;
+    /// the polygons are expressed relative to the anchor pixel, which keeps float precision
+    /// and lets every case be written as a sum of two-edge cross products
+    const int b = index + width, c = index + width + 1, e = index + 1;
+    const int u = index - width, l = index - 1, ul = index - width - 1;
+    const bool has_b = labels[b] == flag, has_c = labels[c] == flag, has_e = labels[e] == flag;
+    const bool has_extra = labels[ul] != flag && labels[l] == flag && labels[u] == flag;
+    float sx = 0.0f, sy = 0.0f, sz = 0.0f;
+    if (has_b && has_c)
+      crossAdd (x[b] - x[index], y[b] - y[index], z[b] - z[index],
+                x[c] - x[index], y[c] - y[index], z[c] - z[index], sx, sy, sz);
+    if (has_c && has_e)
+      crossAdd (x[c] - x[index], y[c] - y[index], z[c] - z[index],
+                x[e] - x[index], y[e] - y[index], z[e] - z[index], sx, sy, sz);
+    if (has_b && has_e && !has_c)
+      crossAdd (x[b] - x[index], y[b] - y[index], z[b] - z[index],
+                x[e] - x[index], y[e] - y[index], z[e] - z[index], sx, sy, sz);
+    if (has_extra)
+      crossAdd (x[u] - x[index], y[u] - y[index], z[u] - z[index],
+                x[l] - x[index], y[l] - y[index], z[l] - z[index], sx, sy, sz);
+    sums[flag * 3] += sx;
+    sums[flag * 3 + 1] += sy;
+    sums[flag * 3 + 2] += sz;
+  }
+
+#if defined(__SSE2__)
+  void
+  SegmentsArea::sumOfSmallFacesBlock (const float *x, const float *y, const float *z, const int *labels,
+                                      int width, int index, double *sums)
+  {
+    const __m128i la = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + index));
+    const __m128i valid = _mm_cmpgt_epi32 (la, _mm_set1_epi32 (-1));
+    if (_mm_movemask_epi8 (valid) == 0)
+      return;
+
+    const int b = index + width, c = index + width + 1, e = index + 1;
+    const int u = index - width, l = index - 1, ul = index - width - 1;
+    const __m128i has_b = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + b)));
+    const __m128i has_c = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + c)));
+    const __m128i has_e = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + e)));
+    const __m128i has_u = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + u)));
+    const __m128i has_l = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + l)));
+    const __m128i has_ul = _mm_cmpeq_epi32 (la, _mm_loadu_si128 (reinterpret_cast<const __m128i*> (labels + ul)));
+
+    /// and-masks rather than multiplications, so NaN coordinates of unlabeled neighbours are dropped
+    const __m128 m_bc = _mm_castsi128_ps (_mm_and_si128 (valid, _mm_and_si128 (has_b, has_c)));
+    const __m128 m_ce = _mm_castsi128_ps (_mm_and_si128 (valid, _mm_and_si128 (has_c, has_e)));
+    const __m128 m_be = _mm_castsi128_ps (_mm_andnot_si128 (has_c, _mm_and_si128 (valid, _mm_and_si128 (has_b, has_e))));
+    const __m128 m_ul = _mm_castsi128_ps (_mm_andnot_si128 (has_ul, _mm_and_si128 (valid, _mm_and_si128 (has_u, has_l))));
+
+    const __m128 ax = _mm_loadu_ps (x + index), ay = _mm_loadu_ps (y + index), az = _mm_loadu_ps (z + index);
+    const __m128 bx = _mm_sub_ps (_mm_loadu_ps (x + b), ax), by = _mm_sub_ps (_mm_loadu_ps (y + b), ay), bz = _mm_sub_ps (_mm_loadu_ps (z + b), az);
+    const __m128 cx = _mm_sub_ps (_mm_loadu_ps (x + c), ax), cy = _mm_sub_ps (_mm_loadu_ps (y + c), ay), cz = _mm_sub_ps (_mm_loadu_ps (z + c), az);
+    const __m128 ex = _mm_sub_ps (_mm_loadu_ps (x + e), ax), ey = _mm_sub_ps (_mm_loadu_ps (y + e), ay), ez = _mm_sub_ps (_mm_loadu_ps (z + e), az);
+    const __m128 ux = _mm_sub_ps (_mm_loadu_ps (x + u), ax), uy = _mm_sub_ps (_mm_loadu_ps (y + u), ay), uz = _mm_sub_ps (_mm_loadu_ps (z + u), az);
+    const __m128 lx = _mm_sub_ps (_mm_loadu_ps (x + l), ax), ly = _mm_sub_ps (_mm_loadu_ps (y + l), ay), lz = _mm_sub_ps (_mm_loadu_ps (z + l), az);
+
+    __m128 sx = _mm_setzero_ps (), sy = _mm_setzero_ps (), sz = _mm_setzero_ps ();
+    crossAdd (bx, by, bz, cx, cy, cz, m_bc, sx, sy, sz);
+    crossAdd (cx, cy, cz, ex, ey, ez, m_ce, sx, sy, sz);
+    crossAdd (bx, by, bz, ex, ey, ez, m_be, sx, sy, sz);
+    crossAdd (ux, uy, uz, lx, ly, lz, m_ul, sx, sy, sz);
+
+    float lane_x[4], lane_y[4], lane_z[4];
+    _mm_storeu_ps (lane_x, sx);
+    _mm_storeu_ps (lane_y, sy);
+    _mm_storeu_ps (lane_z, sz);
+    for (int k = 0; k < 4; k++)
+    {
+      const int flag = labels[index + k];
+      if (flag < 0)
+        continue;
+      sums[flag * 3] += lane_x[k];
+      sums[flag * 3 + 1] += lane_y[k];
+      sums[flag * 3 + 2] += lane_z[k];
+    }
+  }
+#endif
+
+  int
+  SegmentsArea::numberOfThreads () const
+  {
+#ifdef _OPENMP
+    return number_of_threads_ > 0 ? number_of_threads_ : omp_get_max_threads ();
+#else
+    return 1;
+#endif
+  }
+
   void
   SegmentsArea::areaByDelaunayTriangulation (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments)
   {
@@ -204,7 +335,7 @@ namespace tams
     for (it = segments->begin (); it != segments->end (); it++)
     {
       double area = 0.0;
-      projectSegmentTo2D (*it, cgal_points);
+      projectSegmentTo2D (*cloud, *it, cgal_points);
       Delaunay delaunay_triangulation;
       delaunay_triangulation.insert (cgal_points.begin (), cgal_points.end ());
       //Delaunay::All_faces_iterator fit;
@@ -251,9 +382,28 @@ namespace tams
     for (it = segments->begin (); it != segments->end (); it++)
     {
       //std::cerr << "segment " << it - segments->begin () << " with " << it->points.size() << " points.\n";
-      double area = 0.0;
-      Alpha_shape_2 alpha_shape;
-      projectSegmentTo2D (*it, cgal_points);
+      it->area = alphaShapeArea (*cloud, *it, cgal_points);
+    }
+
+    //stop the timer
+    if (verbose_)
+    {
+      gettimeofday(&tpend,NULL);
+      timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
+      timeuse/=1000000;
+      area_calculation_time << " " << timeuse << std::endl;
+      area_calculation_time.close ();
+    }
+  }
+
+
+  double
+  SegmentsArea::alphaShapeArea (const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                                std::vector<CGALPoint2> &cgal_points)
+  {
+    double area = 0.0;
+    Alpha_shape_2 alpha_shape;
+    projectSegmentTo2D (cloud, segment, cgal_points);
 
 //      char buf[4];
 //      sprintf(buf, "%03d", it - segments->begin ());
@@ -266,60 +416,92 @@ namespace tams
 //        of << pit->x() << " " << pit->y() << std::endl;
 //      }
 //      of.close ();
-      alpha_shape.set_mode(Alpha_shape_2::GENERAL);
-      alpha_shape.make_alpha_shape(cgal_points.begin(), cgal_points.end());
-      Alpha_shape_2::Alpha_iterator opt = alpha_shape.find_optimal_alpha (1);
+    alpha_shape.set_mode(Alpha_shape_2::GENERAL);
+    alpha_shape.make_alpha_shape(cgal_points.begin(), cgal_points.end());
+    Alpha_shape_2::Alpha_iterator opt = alpha_shape.find_optimal_alpha (1);
 //      std::cerr << "Optimum alpha value found: " << *opt << std::endl;
-      alpha_shape.set_alpha(*opt);
+    alpha_shape.set_alpha(*opt);
 
-      for (Alpha_shape_2::Finite_faces_iterator fit = alpha_shape.finite_faces_begin ();
-           fit != alpha_shape.finite_faces_end (); fit ++)
+    for (Alpha_shape_2::Finite_faces_iterator fit = alpha_shape.finite_faces_begin ();
+         fit != alpha_shape.finite_faces_end (); fit ++)
+    {
+      if (alpha_shape.classify (fit) == Alpha_shape_2::INTERIOR)
       {
-        if (alpha_shape.classify (fit) == Alpha_shape_2::INTERIOR)
-        {
-          CGALPoint2 aa = fit->vertex(0)->point();//cgal_points[fit->(0)];
-          CGALPoint2 bb = fit->vertex(1)->point();//cgal_points[fit->ccw(1)];
-          CGALPoint2 cc = fit->vertex(2)->point();//cgal_points[fit->ccw(2)];
-          area += fabs(aa.x () * bb.y () - aa.x () * cc.y () +
-                       bb.x () * cc.y () - bb.x () * aa.y () +
-                       cc.x () * aa.y () - cc.x () * bb.y ());
-        }
+        CGALPoint2 aa = fit->vertex(0)->point();//cgal_points[fit->(0)];
+        CGALPoint2 bb = fit->vertex(1)->point();//cgal_points[fit->ccw(1)];
+        CGALPoint2 cc = fit->vertex(2)->point();//cgal_points[fit->ccw(2)];
+        area += fabs(aa.x () * bb.y () - aa.x () * cc.y () +
+                     bb.x () * cc.y () - bb.x () * aa.y () +
+                     cc.x () * aa.y () - cc.x () * bb.y ());
       }
-      it->area = 0.5 * area;
     }
+    return 0.5 * area;
+  }
 
-    //stop the timer
-    if (verbose_)
+  void
+  SegmentsArea::areaByAlphaShape (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments,
+                                  double min_area)
+  {
+    /// the occupied cells are not a bound of the alpha-shape area, a segment is skipped only if its convex hull,
+    /// which contains all Delaunay triangles, is below min_area as well
+    areaByOccupancyGrid (cloud, segments);
+    if (area_estimates_.size () != segments->size ())
     {
-      gettimeofday(&tpend,NULL);
-      timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
-      timeuse/=1000000;
-      area_calculation_time << " " << timeuse << std::endl;
-      area_calculation_time.close ();
+      areaByAlphaShape (cloud, segments);
+      return;
     }
+
+    std::vector<CGALPoint2> cgal_points, hull;
+    int skipped = 0;
+    for (PlanarSegment::StdVector::iterator it = segments->begin (); it != segments->end (); it++)
+    {
+      if (area_estimates_[it - segments->begin ()].occupied < min_area)
+      {
+        double hull_area = convexHullArea (*cloud, *it, cgal_points, hull);
+        if (hull_area < min_area)
+        {
+          it->area = std::min (it->area, hull_area);
+          skipped ++;
+          continue;
+        }
+      }
+      it->area = alphaShapeArea (*cloud, *it, cgal_points);
+    }
+    if (verbose_)
+      std::cout << skipped << " of " << segments->size () << " segments are below " << min_area
+                << " and skipped the alpha shape.\n";
   }
 
+  double
+  SegmentsArea::convexHullArea (const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                                std::vector<CGALPoint2> &cgal_points, std::vector<CGALPoint2> &hull)
+  {
+    projectSegmentTo2D (cloud, segment, cgal_points);
+    hull.clear ();
+    CGAL::convex_hull_2 (cgal_points.begin (), cgal_points.end (), std::back_inserter (hull));
+
+    /// shoelace formula over the counterclockwise vertices
+    double area = 0.0;
+    for (size_t i = 0, j = hull.size () - 1; i < hull.size (); j = i++)
+      area += hull[j].x () * hull[i].y () - hull[i].x () * hull[j].y ();
+    return (0.5 * fabs (area));
+  }
 
-  void
-  SegmentsArea::projectSegmentTo2D(PlanarSegment segment, std::vector<CGALPoint2> &cgal_points)
+  Eigen::Matrix3d
+  SegmentsArea::planeBasis (const PlanarSegment &segment)
   {
     Eigen::EigenSolver<Eigen::Matrix3d> eigensolver;
     Eigen::Vector3d eigenvalues = Eigen::Vector3d::Zero();
     Eigen::Matrix3d eigenvectors = Eigen::Matrix3d::Zero();
     int min_eigenvalue_index, max_eigenvalue_index;
-    double min_eigenvalue, max_eigenvalue;
 
-    Eigen::Matrix3d rotation;
-    Eigen::Vector3d translation;
     Eigen::Matrix3d real_bases;
 
-
     eigensolver.compute(segment.scatter_matrix);
     eigenvalues = eigensolver.eigenvalues().real();
     eigenvectors = eigensolver.eigenvectors().real();
-    min_eigenvalue = eigenvalues.minCoeff(&min_eigenvalue_index);
-    max_eigenvalue = eigenvalues.maxCoeff(&max_eigenvalue_index);
-
+    eigenvalues.minCoeff(&min_eigenvalue_index);
+    eigenvalues.maxCoeff(&max_eigenvalue_index);
 
     real_bases.col(2) = eigenvectors.col(min_eigenvalue_index);
     real_bases.col(0) = eigenvectors.col(max_eigenvalue_index);
@@ -327,24 +509,31 @@ namespace tams
 
     //std::cerr << real_bases.col(0).dot(real_bases.col(2)) << std::endl;
 
-    rotation = real_bases.transpose();
+    return real_bases.transpose();
+  }
+
+  void
+  SegmentsArea::projectSegmentTo2D(const pcl::PointCloud<pcl::PointXYZ> &cloud, const PlanarSegment &segment,
+                                   std::vector<CGALPoint2> &cgal_points)
+  {
+    Eigen::Matrix3d rotation = planeBasis (segment);
 
     cgal_points.clear ();
     cgal_points.resize (segment.points.size ());
 
     Eigen::Vector3d tmp;
     size_t j = 0;
-    for (std::vector<int>::iterator it = segment.points.begin (); it != segment.points.end (); it++, j++)
+    for (std::vector<int>::const_iterator it = segment.points.begin (); it != segment.points.end (); it++, j++)
     {
-      tmp = rotation * points_[*it];
+      tmp = rotation * point (cloud, *it);
       cgal_points[j] = CGALPoint2(tmp(0), tmp(1));
 
     }
   }
 
-
   void
-  SegmentsArea::areaByNumberOfSquareUnits (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments)
+  SegmentsArea::areaByOccupancyGrid (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments,
+                                     bool closing)
   {
     struct timeval tpstart,tpend;
     double timeuse;
@@ -354,19 +543,85 @@ namespace tams
       gettimeofday(&tpstart,NULL);
     }
 
-    double tan_theta = tan(vertical_resolution_ * M_PI / 180);
-    double tan_phi = tan(horizontal_resolution_ * M_PI / 180);
+    area_estimates_.clear ();
+    if (vertical_resolution_ == 0.0 || horizontal_resolution_ == 0.0)
+    {
+      std::cerr << "Please give the sensor resolution in order to use the method OccupancyGrid.\n";
+      return;
+    }
+    area_estimates_.resize (segments->size ());
 
-    Eigen::Vector3d point;
+    /// cells are about the point spacing of the sensor at the segment, so that a scanned patch is gap free
+    const double tan_resolution = tan (std::max (vertical_resolution_, horizontal_resolution_) * M_PI / 180);
+    const double max_cells = 1 << 24;
+    std::vector<double> u, v;
     for (PlanarSegment::StdVector::iterator it = segments->begin (); it != segments->end (); it++)
     {
-      double area = 0.0;
-      for (std::vector<int>::iterator sub_it = it->points.begin(); sub_it != it->points.end (); sub_it++)
+      AreaEstimate &estimate = area_estimates_[it - segments->begin ()];
+      if (it->points.empty ())
       {
-        point = points_[*sub_it];
-        area += point.squaredNorm() * tan_theta * tan_phi / (it->normal.dot(point.normalized()));
+        it->area = 0.0;
+        continue;
       }
-      it->area = area;
+
+      const Eigen::Matrix3d rotation = planeBasis (*it);
+      const size_t point_num = it->points.size ();
+      u.resize (point_num);
+      v.resize (point_num);
+      double min_u = std::numeric_limits<double>::max (), max_u = -std::numeric_limits<double>::max ();
+      double min_v = min_u, max_v = max_u;
+      for (size_t i = 0; i < point_num; i++)
+      {
+        const Eigen::Vector3d projected = rotation * point (*cloud, it->points[i]);
+        u[i] = projected(0);
+        v[i] = projected(1);
+        min_u = std::min (min_u, u[i]);
+        max_u = std::max (max_u, u[i]);
+        min_v = std::min (min_v, v[i]);
+        max_v = std::max (max_v, v[i]);
+      }
+
+      const double range = it->mass_center.norm ();
+      const double cos_incidence = range > 0.0 ? fabs (it->normal.dot (it->mass_center)) / range : 1.0;
+      double cell = range * tan_resolution / std::max (cos_incidence, 0.2);
+      if (!(cell > 1e-4))
+        cell = 1e-4;
+      /// one empty cell of margin on each side, so that closing is not clipped by the grid border
+      int cols = static_cast<int> ((max_u - min_u) / cell) + 3;
+      int rows = static_cast<int> ((max_v - min_v) / cell) + 3;
+      if (static_cast<double> (cols) * rows > max_cells)
+      {
+        cell *= sqrt (static_cast<double> (cols) * rows / max_cells) * 1.01;
+        cols = static_cast<int> ((max_u - min_u) / cell) + 3;
+        rows = static_cast<int> ((max_v - min_v) / cell) + 3;
+      }
+      const int words = (cols + 63) / 64;
+
+      grid_.assign (rows * words, 0);
+      for (size_t i = 0; i < point_num; i++)
+      {
+        const int col = static_cast<int> ((u[i] - min_u) / cell) + 1;
+        const int row = static_cast<int> ((v[i] - min_v) / cell) + 1;
+        grid_[row * words + (col >> 6)] |= static_cast<uint64_t> (1) << (col & 63);
+      }
+      if (closing)
+      {
+        morphology3x3 (grid_, rows, words, true, grid_tmp_);
+        morphology3x3 (grid_tmp_, rows, words, false, grid_);
+      }
+      morphology3x3 (grid_, rows, words, false, grid_tmp_);
+
+      long occupied = 0, interior = 0;
+      for (size_t i = 0; i < grid_.size (); i++)
+      {
+        occupied += __builtin_popcountll (grid_[i]);
+        interior += __builtin_popcountll (grid_tmp_[i]);
+      }
+      /// interior cells are mostly covered by the alpha shape, boundary cells about half on average
+      const double cell_area = cell * cell;
+      estimate.interior = interior * cell_area;
+      estimate.occupied = occupied * cell_area;
+      it->area = 0.5 * (estimate.interior + estimate.occupied);
     }
 
     //stop the timer
@@ -375,22 +630,75 @@ namespace tams
       gettimeofday(&tpend,NULL);
       timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
       timeuse/=1000000;
-      std::cout << "Area calculation time using the NumberOfSquareUnits method: " << timeuse << std::endl;
+      std::cout << "Area calculation time using the OccupancyGrid method: " << timeuse << std::endl;
+    }
+  }
+
+  void
+  SegmentsArea::morphology3x3 (const std::vector<uint64_t> &in, int rows, int words, bool dilate,
+                               std::vector<uint64_t> &out)
+  {
+    /// separable 3x3 structuring element, first along the bits of a row, then across rows
+    std::vector<uint64_t> horizontal (in.size ());
+    for (int y = 0; y < rows; y++)
+    {
+      const uint64_t *row = &in[y * words];
+      for (int w = 0; w < words; w++)
+      {
+        const uint64_t prev = w > 0 ? row[w - 1] : 0;
+        const uint64_t next = w + 1 < words ? row[w + 1] : 0;
+        const uint64_t left = (row[w] << 1) | (prev >> 63);
+        const uint64_t right = (row[w] >> 1) | (next << 63);
+        horizontal[y * words + w] = dilate ? (row[w] | left | right) : (row[w] & left & right);
+      }
+    }
+    out.resize (in.size ());
+    for (int y = 0; y < rows; y++)
+    {
+      for (int w = 0; w < words; w++)
+      {
+        const uint64_t up = y > 0 ? horizontal[(y - 1) * words + w] : 0;
+        const uint64_t down = y + 1 < rows ? horizontal[(y + 1) * words + w] : 0;
+        const uint64_t center = horizontal[y * words + w];
+        out[y * words + w] = dilate ? (up | center | down) : (up & center & down);
+      }
     }
   }
 
+
   void
-  SegmentsArea::toEigenTypes (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud)
+  SegmentsArea::areaByNumberOfSquareUnits (pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, PlanarSegment::StdVectorPtr segments)
   {
-    points_.clear ();
-    points_.resize (cloud->size ());
+    struct timeval tpstart,tpend;
+    double timeuse;
+    //start the timer
+    if (verbose_)
+    {
+      gettimeofday(&tpstart,NULL);
+    }
 
-    for (size_t i = 0; i < cloud->size (); i++)
+    double tan_theta = tan(vertical_resolution_ * M_PI / 180);
+    double tan_phi = tan(horizontal_resolution_ * M_PI / 180);
+
+    Eigen::Vector3d p;
+    for (PlanarSegment::StdVector::iterator it = segments->begin (); it != segments->end (); it++)
     {
-      points_[i](0) = cloud->points[i].x;
-      points_[i](1) = cloud->points[i].y;
-      points_[i](2) = cloud->points[i].z;
+      double area = 0.0;
+      for (std::vector<int>::iterator sub_it = it->points.begin(); sub_it != it->points.end (); sub_it++)
+      {
+        p = point (*cloud, *sub_it);
+        area += p.squaredNorm() * tan_theta * tan_phi / (it->normal.dot(p.normalized()));
+      }
+      it->area = area;
     }
 
+    //stop the timer
+    if (verbose_)
+    {
+      gettimeofday(&tpend,NULL);
+      timeuse=1000000*(tpend.tv_sec-tpstart.tv_sec) + tpend.tv_usec-tpstart.tv_usec;
+      timeuse/=1000000;
+      std::cout << "Area calculation time using the NumberOfSquareUnits method: " << timeuse << std::endl;
+    }
   }
 }
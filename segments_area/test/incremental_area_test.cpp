@@ -0,0 +1,156 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Technical Aspects of Multimodal Systems (TAMS) - http://tams-www.informatik.uni-hamburg.de/
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of TAMS, nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Author : Junhao Xiao
+ * Email  : junhao.xiao@ieee.org, xiao@informatik.uni-hamburg.de
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <set>
+#include <utility>
+#include <Eigen/Geometry>
+#include "segments_area/incremental_area.h"
+
+/** Test of IncrementalArea on the plane z = 0 of the map, whose local frame is u = y, v = -x.
+    The points are scanned in batches from different poses. Each batch is added in the frame of its own scan,
+    and the cells are compared with a full rasterization of all points in the map frame. */
+namespace
+{
+  typedef std::set<std::pair<int, int> > CellSet;
+
+  const double cell_size = 0.1;
+
+  /** the cell of a map point in the local frame of the plane. */
+  std::pair<int, int>
+  cellOf (const Eigen::Vector3d &point)
+  {
+    return (std::make_pair (static_cast<int> (floor (point (1) / cell_size)), static_cast<int> (floor (-point (0) / cell_size))));
+  }
+}
+
+int
+main ()
+{
+  using namespace tams;
+  int failures = 0;
+  srand (1);
+
+  /** the points are kept away from the cell borders, so that the scan poses do not move them into another cell. */
+  const int batch_num = 5;
+  const int batch_size = 400;
+  std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > map_points;
+  for (int b = 0; b < batch_num; b++)
+  {
+    for (int k = 0; k < batch_size; k++)
+    {
+      int cell_x = rand () % 40 - 20 + 8 * b;
+      int cell_y = rand () % 30 - 15;
+      double x = (cell_x + 0.2 + 0.6 * rand () / RAND_MAX) * cell_size;
+      double y = (cell_y + 0.2 + 0.6 * rand () / RAND_MAX) * cell_size;
+      map_points.push_back (Eigen::Vector3d (x, y, 0.0));
+    }
+  }
+
+  IncrementalArea plane (cell_size);
+  plane.setPlane (Eigen::Vector3d::UnitZ (), Eigen::Vector3d::Zero ());
+  CellSet cells;
+  for (int b = 0; b < batch_num; b++)
+  {
+    /** the batch in the frame of its scan, p_map = rotation * p_scan + translation. */
+    Eigen::Matrix3d rotation = (Eigen::AngleAxisd (0.3 * b, Eigen::Vector3d::UnitZ ()) *
+                                Eigen::AngleAxisd (0.1 * b, Eigen::Vector3d::UnitX ())).toRotationMatrix ();
+    Eigen::Vector3d translation (1.5 * b, -0.5 * b, 0.2 * b);
+    pcl::PointCloud<pcl::PointXYZ> cloud;
+    std::vector<int> indices;
+    CellSet batch_cells;
+    for (int k = 0; k < batch_size; k++)
+    {
+      const Eigen::Vector3d &point = map_points[b * batch_size + k];
+      Eigen::Vector3d scan_point = rotation.transpose () * (point - translation);
+      cloud.points.push_back (pcl::PointXYZ (scan_point (0), scan_point (1), scan_point (2)));
+      indices.push_back (k);
+      batch_cells.insert (cellOf (point));
+    }
+
+    /** an update only occupies the cells of its own points which were still empty. */
+    size_t cell_num = cells.size ();
+    cells.insert (batch_cells.begin (), batch_cells.end ());
+    int expected_new = static_cast<int> (cells.size () - cell_num);
+    int new_cells = plane.addPoints (cloud, indices, rotation, translation);
+    if (new_cells != expected_new || new_cells > static_cast<int> (batch_cells.size ()))
+    {
+      printf ("batch %d occupies %d new cells instead of %d\n", b, new_cells, expected_new);
+      failures++;
+    }
+
+    /** the area after every batch is the one of the full rasterization of all points so far. */
+    double expected_area = cells.size () * cell_size * cell_size;
+    if (plane.occupiedCells () != static_cast<long> (cells.size ()) || fabs (plane.area () - expected_area) > 1e-9)
+    {
+      printf ("area %f after batch %d instead of %f\n", plane.area (), b, expected_area);
+      failures++;
+    }
+
+    /** adding the same points again changes nothing. */
+    if (plane.addPoints (cloud, indices, rotation, translation) != 0)
+    {
+      printf ("batch %d occupies new cells when it is added again\n", b);
+      failures++;
+    }
+  }
+
+  /** the full rasterization of all points at once gives the same area. */
+  pcl::PointCloud<pcl::PointXYZ> map_cloud;
+  std::vector<int> all_indices;
+  for (size_t k = 0; k < map_points.size (); k++)
+  {
+    map_cloud.points.push_back (pcl::PointXYZ (map_points[k] (0), map_points[k] (1), map_points[k] (2)));
+    all_indices.push_back (static_cast<int> (k));
+  }
+  IncrementalArea full (cell_size);
+  full.setPlane (Eigen::Vector3d::UnitZ (), Eigen::Vector3d::Zero ());
+  full.addPoints (map_cloud, all_indices);
+  if (full.occupiedCells () != plane.occupiedCells ())
+  {
+    printf ("the full rasterization occupies %ld cells, the batches %ld\n", full.occupiedCells (), plane.occupiedCells ());
+    failures++;
+  }
+
+  if (failures == 0)
+    printf ("incremental area test passed\n");
+  return (failures == 0 ? 0 : 1);
+}